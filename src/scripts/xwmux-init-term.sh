@@ -2,23 +2,11 @@
 
 # Register the dimensions (rows/columns) of the current terminal for layout calculation.
 #
-# The socket should be passed in as $1, or inferred from $xwmux.
-#
-# NOTE: $xwmux is not usually set if the shell is a child of a process launched before xwmux.
-# This includes:
-# * Running it from tmux (child of server)
-# * Running it from a hotkey daemon
-
-xwmux_sock_default="/tmp/xwmux.sock"
-if [ -n "$1" ]; then
-    xwmux_sock="$1"
-fi
-
-if [ -z "$xwmux_sock" ]; then
-    xwmux_sock="$xwmux_sock_default"
-fi
+# xwmux-ctl finds the control socket of the xwmux on $DISPLAY itself (see
+# control_socket_path in ipc.h).
 
-session_name="default"
+# Set by xwmux for the root terminal of each output
+session_name="${XWMUX_SESSION:-default}"
 
 # BEGIN VIBECODED SECTION
 
@@ -64,14 +52,14 @@ cols=${reply#*;}
 stty "$old"
 # END VIBECODED SECTION
 
-if ! tmux list-sessions; then
+if ! tmux has-session -t "=$session_name"; then
     tmux new-session -d -s "$session_name"
 fi
 
 status_position=$(tmux show-options -g status-position | cut -f 2 -d ' ')
 prefix=$(tmux show-options -g prefix | cut -f 2 -d ' ')
 
-xwmux-ctl init "$rows" "$cols" "$pixel_width" "$pixel_height" "$status_position"
+xwmux-ctl init "$rows" "$cols" "$pixel_width" "$pixel_height" "$status_position" "$session_name"
 xwmux-ctl prefix "$prefix"
 
 tmux new-session -A -s "$session_name"
@@ -3,6 +3,9 @@
 ROOT_TERM_CLASS="xwmux_root"
 EXEC_PROGRAM="xwmux-init-term.sh"
 
+# The instance name tells xwmux which output's session the terminal is for
+SESSION_NAME="${XWMUX_SESSION:-default}"
+
 SELECTED="$XWMUX_TERMINAL" || "$TERMINAL"
 
 if [ ! "$SELECTED" ]; then
@@ -21,18 +24,18 @@ fi
 
 case $SELECTED in
 "kitty")
-    kitty --class $ROOT_TERM_CLASS --exec $EXEC_PROGRAM &
+    kitty --class $ROOT_TERM_CLASS --name "$SESSION_NAME" --exec $EXEC_PROGRAM &
     ;;
 "alacritty")
     alacritty --class $ROOT_TERM_CLASS --command $EXEC_PROGRAM &
     ;;
 "st")
     # These handle keypresses fine, but have some weirdness with padding
-    st -c $ROOT_TERM_CLASS -e $EXEC_PROGRAM &
+    st -c $ROOT_TERM_CLASS -n "$SESSION_NAME" -e $EXEC_PROGRAM &
     ;;
 "xterm")
     # xterm has weird padding and doesn't work with tmux in my setup
-    xterm -class $ROOT_TERM_CLASS -e $EXEC_PROGRAM -b 0 &
+    xterm -class $ROOT_TERM_CLASS -name "$SESSION_NAME" -e $EXEC_PROGRAM -b 0 &
     ;;
 *)
     eval "$SELECTED"
@@ -1,12 +1,6 @@
 #!/usr/bin/env sh
 
-# Update focus
-msg=$(tmux display-message -p '#{q:session_id} #{window_id} #{pane_id}')
-eval xwmux-ctl tmux-focus "$msg" 2>/dev/null
+# Report the layout of the current tmux window to xwmux.
+# xwmux follows tmux itself, this is only needed to force an update.
 
-panes=$(tmux list-panes -F "#{pane_active} #{window_zoomed_flag} #{q:session_id} #{window_id} #{pane_id} #{pane_left} #{pane_top} #{pane_width} #{pane_height} #{pane_dead}")
-
-# Update layout
-echo "$panes" |
-    sort -r |
-    xargs -d '\n' -I {} sh -c "xwmux-ctl tmux-position {} || exit 0"
+exec xwmux-ctl report
@@ -1,22 +1,13 @@
 #!/usr/bin/env sh
-# TODO: make idempotent
 
-HOOK_NO=69
-
-tmux set-hook -g after-split-window[$HOOK_NO]     'run-shell "xwmux-report.sh"'
-tmux set-hook -g pane-exited[$HOOK_NO]            'run-shell "xwmux-report.sh"'
-tmux set-hook -g window-pane-changed[$HOOK_NO]    'run-shell "xwmux-report.sh"'
-tmux set-hook -g client-session-changed[$HOOK_NO] 'run-shell "xwmux-report.sh"'
-tmux set-hook -g session-window-changed[$HOOK_NO] 'run-shell "xwmux-report.sh"'
-tmux set-hook -g after-select-window[$HOOK_NO]    'run-shell "xwmux-report.sh"'
-tmux set-hook -g after-new-window[$HOOK_NO]       'run-shell "xwmux-report.sh"'
-tmux set-hook -g after-new-session[$HOOK_NO]      'run-shell "xwmux-report.sh"'
-tmux set-hook -g client-attached[$HOOK_NO]        'run-shell "xwmux-report.sh"'
-tmux set-hook -g client-session-changed[$HOOK_NO] 'run-shell "xwmux-report.sh"'
-tmux set-hook -g after-resize-pane[$HOOK_NO]      'run-shell "xwmux-report.sh"'
-tmux set-hook -g after-select-layout[$HOOK_NO]    'run-shell "xwmux-report.sh"'
+# xwmux follows tmux through control mode notifications, so no hooks are
+# needed anymore. This removes the hooks installed by earlier versions.
 
-tmux set -g focus-events on
-tmux set-hook -g pane-focus-in[$HOOK_NO] 'run-shell "xwmux-report.sh"'
+HOOK_NO=69
 
-tmux set-hook -g after-kill-pane[$HOOK_NO]        'run-shell "xwmux-ctl kill-pane orphans && xwmux-report.sh"'
+for hook in after-split-window pane-exited window-pane-changed \
+    client-session-changed session-window-changed after-select-window \
+    after-new-window after-new-session client-attached after-resize-pane \
+    after-select-layout pane-focus-in after-kill-pane; do
+    tmux set-hook -gu "$hook[$HOOK_NO]"
+done
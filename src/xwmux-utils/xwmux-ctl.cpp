@@ -1,13 +1,29 @@
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <format>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <stdexcept>
+#include <string_view>
+#include <vector>
 
 #include "ipc.h"
+#include "position_ring.h"
 #include "tmux.h"
 #include "tmux_keys.h"
 
+extern char **environ;
+
 struct Command {
   public:
     virtual std::string keyword() const = 0;
@@ -16,11 +32,37 @@ struct Command {
     virtual std::optional<Msg> parse(int argc, char **argv, int cur,
                                      Display *dpy) = 0;
 
+    // Commands sending more than one message override this instead
+    virtual std::vector<Msg> parse_all(int argc, char **argv, int cur,
+                                       Display *dpy) {
+        std::optional<Msg> ret = parse(argc, argv, cur, dpy);
+        if (!ret.has_value()) {
+            return {};
+        }
+        return {ret.value()};
+    }
+
+    // Commands with a reply can't be sent as client messages
+    virtual bool needs_socket() const { return false; }
+
+    // Commands which can skip the socket, through the position ring,
+    // override this, returning whether it was appended
+    virtual bool append(int argc, char **argv) {
+        (void)argc;
+        (void)argv;
+        return false;
+    }
+
+    // Arguments of the request on the control socket
+    virtual std::vector<std::string> request_args(int argc, char **argv) {
+        return std::vector<std::string>(argv, argv + argc);
+    }
+
     virtual ~Command() {}
 
-    virtual std::optional<Msg> operator()(int argc, char **argv, Display *dpy) {
-        std::optional<Msg> ret = parse(argc, argv, 0, dpy);
-        if (!ret.has_value()) {
+    virtual std::vector<Msg> operator()(int argc, char **argv, Display *dpy) {
+        std::vector<Msg> ret = parse_all(argc, argv, 0, dpy);
+        if (ret.empty()) {
             std::cerr << "Usage: xwmux-ctl " << keyword() << usage_suffix()
                       << std::endl;
         }
@@ -34,11 +76,11 @@ struct Command {
 struct InitLayout : Command {
     std::string keyword() const override { return "init"; }
     std::string usage_suffix() const override {
-        return " <rows> <cols> <px_w> <px_h> <bar-position>";
+        return " <rows> <cols> <px_w> <px_h> <bar-position> [<session>]";
     }
     std::optional<Msg> parse(int argc, char **argv, int cur,
                              Display *dpy) override {
-        if (cur + 5 != argc - 1) {
+        if (cur + 5 != argc - 1 && cur + 6 != argc - 1) {
             return std::nullopt;
         }
         std::size_t ch_h = std::atoi(argv[cur + 1]);
@@ -54,7 +96,14 @@ struct InitLayout : Command {
             std::cerr << "bad bar position\n";
         }
 
-        return Msg::report_resolution(dpy, {ch_w, ch_h}, {px_w, px_h}, pos);
+        // Names the head whose root terminal this is
+        Atom session = None;
+        if (cur + 6 == argc - 1) {
+            session = XInternAtom(dpy, argv[cur + 6], False);
+        }
+
+        return Msg::report_resolution(dpy, {ch_w, ch_h}, {px_w, px_h}, pos,
+                                      session);
     }
 };
 
@@ -128,6 +177,26 @@ struct NotifyTmuxPosition : Command {
     }
     std::optional<Msg> parse(int argc, char **argv, int cur,
                              Display *dpy) override {
+        std::optional<TmuxPaneReport> report = parse_report(argc, argv, cur);
+        if (!report.has_value()) {
+            return std::nullopt;
+        }
+        return Msg::report_position(dpy, report.value());
+    }
+
+    bool append(int argc, char **argv) override {
+        PositionRingProducer ring;
+        if (!ring.connected()) {
+            return false;
+        }
+        std::optional<TmuxPaneReport> report = parse_report(argc, argv, 0);
+        return report.has_value() &&
+               ring.push(PositionRecord::from_report(report.value()));
+    }
+
+  private:
+    std::optional<TmuxPaneReport> parse_report(int argc, char **argv,
+                                               int cur) {
         if (cur + 10 != argc - 1) {
             std::cout << "wrong args\n";
             return std::nullopt;
@@ -138,6 +207,13 @@ struct NotifyTmuxPosition : Command {
             bool focused = std::stoi(argv[cur++]);
             bool zoomed = std::stoi(argv[cur++]);
 
+            // Picks the head for windows xwmux has not seen yet
+            if (argv[cur][0] != '$') {
+                std::cout << "couldn't get session\n";
+                return std::nullopt;
+            }
+            TmuxSessionID session = std::stoi(argv[cur] + 1);
+
             std::optional<TmuxLocation> loc = get_loc(argc, argv, cur);
             if (!loc.has_value()) {
                 std::cout << "couldn't get loc\n";
@@ -152,11 +228,15 @@ struct NotifyTmuxPosition : Command {
             pane_height = std::stoi(argv[cur++]);
             bool dead = std::stoi(argv[cur++]);
 
-            return Msg::report_position(
-                dpy, loc.value(),
-                WindowPosition({pane_left, pane_top}, {pane_left + pane_width,
-                                                       pane_top + pane_height}),
-                focused, zoomed, dead);
+            return TmuxPaneReport{
+                .location = loc.value(),
+                .position = WindowPosition(
+                    {pane_left, pane_top},
+                    {pane_left + pane_width, pane_top + pane_height}),
+                .focused = focused,
+                .zoomed = zoomed,
+                .dead = dead,
+                .session = session};
 
         } catch (std::invalid_argument &e) {
             std::cout << "couldn't get rest\n";
@@ -165,6 +245,198 @@ struct NotifyTmuxPosition : Command {
     }
 };
 
+// Report all panes in the current tmux window, with a single tmux query, as
+// one snapshot
+struct Report : Command {
+    std::string keyword() const override { return "report"; }
+    std::string usage_suffix() const override { return ""; }
+    std::optional<Msg> parse(int argc, char **argv, int cur,
+                             Display *dpy) override {
+        (void)argc;
+        (void)argv;
+        (void)cur;
+        (void)dpy;
+        return std::nullopt;
+    }
+    std::vector<Msg> parse_all(int argc, char **argv, int cur,
+                               Display *dpy) override {
+        (void)argv;
+        (void)cur;
+        if (argc != 1) {
+            return {};
+        }
+
+        std::vector<TmuxPaneReport> panes = parse_pane_reports(list_panes());
+        if (panes.empty()) {
+            return {};
+        }
+        write_snapshot(dpy, panes);
+        return {Msg::report_snapshot(dpy)};
+    }
+
+    // xwmux refreshes the output following our session
+    std::vector<std::string> request_args(int argc, char **argv) override {
+        std::vector<std::string> ret = Command::request_args(argc, argv);
+        std::optional<std::string> session = current_session();
+        if (argc == 1 && session.has_value()) {
+            ret.push_back(session.value());
+        }
+        return ret;
+    }
+
+  private:
+    // "$<session-id>" when run inside tmux (from $TMUX, which ends with it),
+    // otherwise the session named for xwmux
+    static std::optional<std::string> current_session() {
+        const char *tmux = std::getenv("TMUX");
+        if (tmux) {
+            std::string_view value = tmux;
+            size_t comma = value.rfind(',');
+            if (comma != std::string_view::npos && comma + 1 < value.size()) {
+                return std::format("${}", value.substr(comma + 1));
+            }
+        }
+        const char *session = std::getenv(SESSION_VAR.c_str());
+        if (session && *session) {
+            return session;
+        }
+        return std::nullopt;
+    }
+
+    // Run without a shell, as the launcher runs everything
+    static std::vector<std::string> list_panes() {
+        std::vector<std::string> lines;
+        int out[2];
+        if (pipe2(out, O_CLOEXEC)) {
+            return lines;
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+        std::string format(PANE_REPORT_FORMAT);
+        char *argv[] = {const_cast<char *>("tmux"),
+                        const_cast<char *>("list-panes"),
+                        const_cast<char *>("-F"), format.data(), nullptr};
+        pid_t pid;
+        int err =
+            posix_spawnp(&pid, "tmux", &actions, nullptr, argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(out[1]);
+        if (err) {
+            close(out[0]);
+            return lines;
+        }
+
+        std::string output;
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(out[0], buf, sizeof(buf))) > 0 ||
+               (n < 0 && errno == EINTR)) {
+            if (n > 0) {
+                output.append(buf, n);
+            }
+        }
+        close(out[0]);
+        while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {
+        }
+
+        std::string_view rest = output;
+        while (!rest.empty()) {
+            size_t end = rest.find('\n');
+            lines.emplace_back(rest.substr(0, end));
+            rest.remove_prefix(end == std::string_view::npos ? rest.size()
+                                                             : end + 1);
+        }
+        return lines;
+    }
+};
+
+// One line per output: "<output> <session> <connected> <windows> <overlays>"
+struct ShowStatus : Command {
+    std::string keyword() const override { return "status"; }
+    std::string usage_suffix() const override { return ""; }
+    bool needs_socket() const override { return true; }
+    std::optional<Msg> parse(int argc, char **argv, int cur,
+                             Display *dpy) override {
+        (void)argc;
+        (void)argv;
+        (void)cur;
+        (void)dpy;
+        return std::nullopt;
+    }
+};
+
+// Run from tmux hooks, which must not hang on a wedged xwmux
+constexpr timeval CONTROL_TIMEOUT{.tv_sec = 2, .tv_usec = 0};
+
+// The reply of xwmux to a request on its control socket, or nothing if it is
+// not listening
+std::optional<ControlReply> send_request(const ControlRequest &request) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::string path = control_socket_path();
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return std::nullopt;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+        close(fd);
+        return std::nullopt;
+    }
+
+    // Only our own xwmux is handed the request, or trusted with the reply
+    ucred cred{};
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) ||
+        cred.uid != getuid()) {
+        close(fd);
+        return std::nullopt;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &CONTROL_TIMEOUT,
+               sizeof(CONTROL_TIMEOUT));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &CONTROL_TIMEOUT,
+               sizeof(CONTROL_TIMEOUT));
+
+    // The request ends where our side of the connection does
+    std::string data = request.encode();
+    std::string_view rest = data;
+    while (!rest.empty()) {
+        ssize_t n = send(fd, rest.data(), rest.size(), MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            close(fd);
+            return ControlReply{.ok = false,
+                                .output = errno == EAGAIN
+                                              ? "xwmux is not responding\n"
+                                              : "Connection lost\n"};
+        }
+        rest.remove_prefix(n);
+    }
+    shutdown(fd, SHUT_WR);
+
+    std::string reply;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+        if (n > 0) {
+            reply.append(buf, n);
+        }
+    }
+    bool timed_out = n < 0 && errno == EAGAIN;
+    close(fd);
+    if (timed_out) {
+        return ControlReply{.ok = false, .output = "xwmux is not responding\n"};
+    }
+    return ControlReply::decode(reply);
+}
+
 std::unique_ptr<Command> parse_cmd(std::string cmd) {
     if (cmd == InitLayout().keyword()) {
         return std::make_unique<InitLayout>();
@@ -176,6 +448,10 @@ std::unique_ptr<Command> parse_cmd(std::string cmd) {
         return std::make_unique<KillPane>();
     } else if (cmd == NotifyTmuxPosition().keyword()) {
         return std::make_unique<NotifyTmuxPosition>();
+    } else if (cmd == Report().keyword()) {
+        return std::make_unique<Report>();
+    } else if (cmd == ShowStatus().keyword()) {
+        return std::make_unique<ShowStatus>();
     }
     return nullptr;
 }
@@ -196,18 +472,47 @@ int main(int argc, char **argv) {
         std::cerr << usage << std::endl;
         return EXIT_FAILURE;
     }
-    Display *dpy = XOpenDisplay(nullptr);
-    std::optional<Msg> opt_msg = (*cmd.get())(argc - 1, argv + 1, dpy);
 
-    if (!opt_msg.has_value()) {
+    // Straight into shared memory, if xwmux made the ring
+    if (cmd->append(argc - 1, argv + 1)) {
+        return EXIT_SUCCESS;
+    }
+
+    // Without an X connection, if xwmux is listening
+    std::optional<ControlReply> reply =
+        send_request({.args = cmd->request_args(argc - 1, argv + 1)});
+    if (reply.has_value()) {
+        if (reply->usage_error()) {
+            std::cerr << reply->output << "Usage: xwmux-ctl " << cmd->keyword()
+                      << cmd->usage_suffix() << std::endl;
+            return EXIT_FAILURE;
+        } else if (!reply->ok) {
+            std::cerr << reply->output;
+            return EXIT_FAILURE;
+        }
+        std::cout << reply->output;
+        return EXIT_SUCCESS;
+    }
+    if (cmd->needs_socket()) {
+        std::cerr << "xwmux is not listening on " << control_socket_path()
+                  << std::endl;
         return EXIT_FAILURE;
     }
-    XEvent ev = opt_msg.value().get_event();
 
-    if (!XSendEvent(dpy, XDefaultRootWindow(dpy), false,
-                    SubstructureRedirectMask, &ev)) {
+    Display *dpy = XOpenDisplay(nullptr);
+    std::vector<Msg> msgs = (*cmd.get())(argc - 1, argv + 1, dpy);
+
+    if (msgs.empty()) {
         return EXIT_FAILURE;
-    };
+    }
+
+    // Sent together, on closing the display
+    for (Msg &msg : msgs) {
+        if (!XSendEvent(dpy, XDefaultRootWindow(dpy), false,
+                        SubstructureRedirectMask, &msg.get_event())) {
+            return EXIT_FAILURE;
+        };
+    }
 
     XCloseDisplay(dpy);
 }
@@ -0,0 +1,104 @@
+/*
+ * Registry of every atom used by xwmux and xwmux-ctl.
+ *
+ * Interning an atom is a round trip to the server, so they are all interned
+ * together, once, and then looked up by AtomID.
+ */
+
+#pragma once
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <unordered_map>
+
+enum class AtomID : std::size_t {
+    // Client messages, in the same order as MsgType
+    XW_RESOLUTION,
+    XW_PREFIX,
+    XW_EXIT,
+    XW_TMUX_POSITION,
+    XW_KILL_PANE,
+    XW_KILL_ORPHANS,
+    XW_TMUX_SNAPSHOT,
+
+    // ICCCM
+    WM_PROTOCOLS,
+    WM_DELETE_WINDOW,
+
+    // EWMH
+    NET_WM_NAME,
+    UTF8_STRING,
+    NET_WM_STATE,
+    NET_WM_STATE_HIDDEN,
+    NET_WM_STATE_FULLSCREEN,
+    NET_WM_SYNC_REQUEST,
+    NET_WM_SYNC_REQUEST_COUNTER,
+    NET_WM_PID,
+    NET_WM_WINDOW_TYPE,
+    NET_WM_WINDOW_TYPE_DIALOG,
+    NET_WM_WINDOW_TYPE_UTILITY,
+    NET_WM_WINDOW_TYPE_SPLASH,
+    NET_SUPPORTED,
+    NET_SUPPORTING_WM_CHECK,
+
+    COUNT
+};
+
+constexpr std::size_t ATOM_COUNT = static_cast<std::size_t>(AtomID::COUNT);
+
+// Indexed by AtomID
+constexpr std::array<const char *, ATOM_COUNT> ATOM_NAMES = {
+    "_XW_RESOUTION",     "_XW_PREFIX",       "_XW_EXIT",
+    "_XW_TMUX_POSITION", "_XW_KILL_PANE",    "_XW_KILL_ORPHANS",
+    "_XW_TMUX_SNAPSHOT", "WM_PROTOCOLS",     "WM_DELETE_WINDOW",
+    "_NET_WM_NAME",      "UTF8_STRING",      "_NET_WM_STATE",
+    "_NET_WM_STATE_HIDDEN", "_NET_WM_STATE_FULLSCREEN",
+    "_NET_WM_SYNC_REQUEST", "_NET_WM_SYNC_REQUEST_COUNTER", "_NET_WM_PID",
+    "_NET_WM_WINDOW_TYPE", "_NET_WM_WINDOW_TYPE_DIALOG",
+    "_NET_WM_WINDOW_TYPE_UTILITY", "_NET_WM_WINDOW_TYPE_SPLASH",
+    "_NET_SUPPORTED", "_NET_SUPPORTING_WM_CHECK",
+};
+static_assert(ATOM_NAMES.back() != nullptr, "Every AtomID needs a name");
+
+class Atoms {
+  public:
+    // Interns all atoms in a single request
+    Atoms(Display *const dpy) {
+        std::array<char *, ATOM_COUNT> names;
+        for (std::size_t i = 0; i < ATOM_COUNT; i++) {
+            names[i] = const_cast<char *>(ATOM_NAMES[i]);
+        }
+        XInternAtoms(dpy, names.data(), ATOM_COUNT, 0, m_atoms.data());
+        for (std::size_t i = 0; i < ATOM_COUNT; i++) {
+            m_ids.emplace(m_atoms[i], static_cast<AtomID>(i));
+        }
+    }
+
+    Atom operator[](const AtomID id) const {
+        return m_atoms[static_cast<std::size_t>(id)];
+    }
+
+    // Reverse lookup, without a round trip
+    std::optional<AtomID> find(const Atom atom) const {
+        auto it = m_ids.find(atom);
+        if (it == m_ids.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+  private:
+    std::array<Atom, ATOM_COUNT> m_atoms;
+    std::unordered_map<Atom, AtomID> m_ids;
+};
+
+// Registry for the display of the process, interned on first use
+inline const Atoms &atoms(Display *const dpy) {
+    static const Atoms instance(dpy);
+    return instance;
+}
@@ -0,0 +1,168 @@
+#include "control_server.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+// Make the directory holding the socket, or check one left behind is still
+// only ours. Then nobody else can replace the socket, or connect to it.
+static bool private_dir(const std::string &dir) {
+    if (mkdir(dir.c_str(), S_IRWXU) && errno != EEXIST) {
+        return false;
+    }
+    struct stat st;
+    return !lstat(dir.c_str(), &st) && S_ISDIR(st.st_mode) &&
+           st.st_uid == geteuid() && !(st.st_mode & (S_IRWXG | S_IRWXO));
+}
+
+bool ControlServer::listen() {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (m_path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    std::memcpy(addr.sun_path, m_path.c_str(), m_path.size() + 1);
+
+    if (!private_dir(m_path.substr(0, m_path.rfind('/')))) {
+        return false;
+    }
+
+    // Another xwmux is listening, e.g. started again on the same display
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+        return false;
+    }
+    bool live =
+        !connect(probe, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    ::close(probe);
+    if (live) {
+        return false;
+    }
+
+    m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_fd < 0) {
+        return false;
+    }
+
+    // Left behind by an xwmux which did not exit cleanly
+    unlink(m_path.c_str());
+    if (bind(m_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ||
+        ::listen(m_fd, SOMAXCONN)) {
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    m_poller.add(m_fd);
+    return true;
+}
+
+void ControlServer::close() {
+    for (auto &[fd, client] : m_clients) {
+        m_poller.remove(fd);
+        ::close(fd);
+    }
+    m_clients.clear();
+    if (m_fd >= 0) {
+        m_poller.remove(m_fd);
+        ::close(m_fd);
+        m_fd = -1;
+        unlink(m_path.c_str());
+    }
+}
+
+void ControlServer::dispatch() {
+    if (m_fd < 0) {
+        return;
+    }
+    accept_clients();
+
+    // Dropped once all have had their turn
+    std::vector<int> done;
+    for (auto &[fd, client] : m_clients) {
+        bool open = client.replied ? write_reply(fd, client)
+                                   : read_request(fd, client);
+        if (!open) {
+            done.push_back(fd);
+        }
+    }
+    for (int fd : done) {
+        m_poller.remove(fd);
+        ::close(fd);
+        m_clients.erase(fd);
+    }
+}
+
+void ControlServer::accept_clients() {
+    while (true) {
+        int fd = accept4(m_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0 && errno == EINTR) {
+            continue;
+        } else if (fd < 0) {
+            // EAGAIN, or the client has gone already
+            return;
+        }
+        m_clients.emplace(fd, Client{});
+        m_poller.add(fd);
+    }
+}
+
+bool ControlServer::read_request(const int fd, Client &client) {
+    char buf[4096];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            client.in.append(buf, n);
+            if (client.in.size() > CONTROL_REQUEST_MAX) {
+                reply(fd, client, {.ok = false, .output = "Too long\n"});
+                return write_reply(fd, client);
+            }
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            return true;
+        } else if (n < 0) {
+            return false;
+        } else {
+            // The whole request has been sent
+            std::optional<ControlRequest> request =
+                ControlRequest::decode(client.in);
+            reply(fd, client,
+                  request.has_value()
+                      ? m_handler(request.value())
+                      : ControlReply{.ok = false, .output = "Bad request\n"});
+            return write_reply(fd, client);
+        }
+    }
+}
+
+bool ControlServer::write_reply(const int fd, Client &client) {
+    while (!client.out.empty()) {
+        ssize_t n =
+            send(fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            return true;
+        } else if (n < 0) {
+            return false;
+        }
+        client.out.erase(0, n);
+    }
+    return false;
+}
+
+void ControlServer::reply(const int fd, Client &client,
+                          const ControlReply &reply) {
+    client.in.clear();
+    client.out = reply.encode();
+    client.replied = true;
+
+    // Nothing more is read, so wait for room to write instead
+    m_poller.modify(fd, EPOLLOUT);
+}
@@ -0,0 +1,70 @@
+/*
+ * Server for the control socket, which xwmux-ctl talks to without opening an
+ * X connection of its own (see ControlRequest).
+ *
+ * Everything is non-blocking and driven from the main loop: connections are
+ * accepted, read and written as far as they can be from dispatch(), and each
+ * request is handled on the main thread once it has been read whole.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "ipc.h"
+#include "poller.h"
+
+// Longer requests are refused
+constexpr std::size_t CONTROL_REQUEST_MAX = 1 << 20;
+
+class ControlServer {
+  public:
+    using Handler = std::function<ControlReply(const ControlRequest &)>;
+
+    ControlServer(std::string path, Handler handler)
+        : m_poller(poller()), m_path(std::move(path)),
+          m_handler(std::move(handler)) {}
+
+    ~ControlServer() { close(); }
+
+    ControlServer(const ControlServer &other) = delete;
+    ControlServer &operator=(const ControlServer &other) = delete;
+
+    // Replaces a stale socket, but not one another xwmux still listens on.
+    // Returns false if the socket could not be set up.
+    bool listen();
+
+    // Stop listening and drop all connections
+    void close();
+
+    // Accept, read and reply to whatever can be without blocking
+    void dispatch();
+
+  private:
+    struct Client {
+        std::string in{};
+        std::string out{};
+
+        // The request has been handled, and the reply is being written
+        bool replied{};
+    };
+
+    void accept_clients();
+
+    // Each returns false once the client is done with
+    bool read_request(const int fd, Client &client);
+    bool write_reply(const int fd, Client &client);
+
+    void reply(const int fd, Client &client, const ControlReply &reply);
+
+    Poller &m_poller;
+    std::string m_path;
+    Handler m_handler;
+
+    int m_fd{-1};
+    std::unordered_map<int, Client> m_clients;
+};
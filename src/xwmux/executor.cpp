@@ -0,0 +1,107 @@
+#include "executor.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cstdint>
+
+Executor::Executor()
+    : m_event_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      m_thread(&Executor::run, this) {}
+
+Executor::~Executor() {
+    // Nothing is left to dispatch completions
+    m_closing = true;
+
+    // Queue every overflowed job before the one which stops the thread, which
+    // then drains the queue first. Nothing else wakes us, so wait for room
+    // here.
+    m_overflow.push_back([this] { m_stop = true; });
+    while (!m_overflow.empty()) {
+        flush_overflow();
+        if (!m_overflow.empty()) {
+            m_jobs.wait_nonfull();
+        }
+    }
+    m_thread.join();
+    close(m_event_fd);
+}
+
+void Executor::post(Job job) {
+    if (std::this_thread::get_id() == m_thread.get_id()) {
+        job();
+        return;
+    }
+    // Behind anything already overflowed, to keep jobs in order
+    flush_overflow();
+    if (m_overflow.empty() && m_jobs.push(std::move(job))) {
+        return;
+    }
+    m_overflow.push_back(std::move(job));
+
+    // The executor may have emptied the queue before seeing the flag, then
+    // there is room now
+    m_overflowed = true;
+    flush_overflow();
+}
+
+void Executor::flush_overflow() {
+    while (!m_overflow.empty() && m_jobs.push(std::move(m_overflow.front()))) {
+        m_overflow.pop_front();
+    }
+    if (m_overflow.empty()) {
+        m_overflowed = false;
+    }
+}
+
+void Executor::complete(Job job) {
+    // Would wait forever on a full queue
+    if (m_closing) {
+        return;
+    }
+    while (!m_completions.push(std::move(job))) {
+        m_completions.wait_nonfull();
+    }
+    uint64_t one = 1;
+    if (write(m_event_fd, &one, sizeof(one)) < 0) {
+        // Counter saturated, main thread is woken anyway
+    }
+}
+
+void Executor::dispatch() {
+    uint64_t count;
+    if (read(m_event_fd, &count, sizeof(count)) < 0) {
+        // Nothing signalled, there may still be jobs from a previous wakeup
+    }
+    flush_overflow();
+    Job job;
+    while (m_completions.pop(job)) {
+        job();
+    }
+}
+
+void Executor::run() {
+    Job job;
+    while (true) {
+        while (m_jobs.pop(job)) {
+            job();
+        }
+        if (m_stop) {
+            return;
+        }
+
+        // Room for overflowed jobs, which only the main thread can queue
+        if (m_overflowed) {
+            uint64_t one = 1;
+            if (write(m_event_fd, &one, sizeof(one)) < 0) {
+                // Counter saturated, main thread is woken anyway
+            }
+        }
+        m_jobs.wait_nonempty();
+    }
+}
+
+Executor &executor() {
+    static Executor instance;
+    return instance;
+}
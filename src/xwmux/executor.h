@@ -0,0 +1,121 @@
+/*
+ * Executor thread for outbound work which may block (writing to tmux,
+ * spawning notifications), so the X event loop never waits on it.
+ *
+ * Jobs are posted from the main thread through a bounded lock-free queue and
+ * run in order. Posting never blocks: jobs which don't fit wait in an overflow
+ * list on the main thread, moved to the queue from dispatch() as it drains.
+ * Jobs may hand work back to the main thread, which runs it from dispatch()
+ * once woken through fd().
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <thread>
+
+// Bounded single-producer single-consumer ring
+template <typename T, std::size_t N> class BoundedQueue {
+  public:
+    // Called only by the producer, false if full
+    bool push(T &&item) {
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        m_items[tail % N] = std::move(item);
+        m_tail.store(tail + 1, std::memory_order_release);
+        m_tail.notify_one();
+        return true;
+    }
+
+    // Called only by the consumer, false if empty
+    bool pop(T &item) {
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(m_items[head % N]);
+        m_head.store(head + 1, std::memory_order_release);
+        m_head.notify_one();
+        return true;
+    }
+
+    // Block the consumer until an item is pushed
+    void wait_nonempty() const {
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        m_tail.wait(head, std::memory_order_acquire);
+    }
+
+    // Block the producer until an item is popped
+    void wait_nonfull() const {
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        m_head.wait(tail - N, std::memory_order_acquire);
+    }
+
+  private:
+    std::array<T, N> m_items;
+    alignas(64) std::atomic<std::size_t> m_head{0};
+    alignas(64) std::atomic<std::size_t> m_tail{0};
+};
+
+class Executor {
+  public:
+    using Job = std::function<void()>;
+
+    Executor();
+
+    // Finishes all posted jobs first
+    ~Executor();
+
+    Executor(const Executor &other) = delete;
+    Executor &operator=(const Executor &other) = delete;
+
+    // Run a job on the executor thread, after all previously posted.
+    // Posted from the executor thread itself, jobs run immediately.
+    // Never blocks, the executor may itself be waiting on the main thread
+    // (e.g. tmux blocked on output only the main thread reads).
+    void post(Job job);
+
+    // Run a job on the main thread, from dispatch(). Dropped once exiting.
+    void complete(Job job);
+
+    // Run completed jobs, and queue overflowed ones, on the main thread
+    void dispatch();
+
+    // Readable when there are completed jobs to dispatch, or room for
+    // overflowed ones
+    int fd() const { return m_event_fd; }
+
+  private:
+    void run();
+
+    // Move overflowed jobs to the queue, while there is room
+    void flush_overflow();
+
+    static constexpr std::size_t QUEUE_LEN = 256;
+
+    BoundedQueue<Job, QUEUE_LEN> m_jobs;
+    BoundedQueue<Job, QUEUE_LEN> m_completions;
+
+    // Posted while the queue was full, only touched by the main thread
+    std::deque<Job> m_overflow;
+
+    // Set while there are overflowed jobs, for the executor to wake the main
+    // thread once it has made room
+    std::atomic<bool> m_overflowed{false};
+
+    int m_event_fd;
+
+    // Set once exiting, and by the last job
+    std::atomic<bool> m_closing{false};
+    std::atomic<bool> m_stop{false};
+    std::thread m_thread;
+};
+
+// Executor shared by all outbound work
+Executor &executor();
@@ -0,0 +1,95 @@
+/*
+ * Floating overlays: dialogs, utility windows and splash screens.
+ *
+ * These are short lived and belong to another window, so rather than each
+ * taking a tmux window of its own (a round trip to tmux, and a new entry in
+ * the window list), they are stacked above the terminal, centred over the
+ * pane of the window they are transient for. An overlay is shown and hidden
+ * along with that pane.
+ */
+
+#pragma once
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "layout.h"
+
+struct FloatingWindow {
+    // The window it is transient for, which it is centred over
+    std::optional<Window> parent{};
+
+    // The pane window at the root of the chain of parents, whose visibility
+    // it follows
+    std::optional<Window> owner{};
+
+    // As requested by the client
+    Point size{0, 0};
+
+    bool hidden{};
+
+    // Order in which overlays were raised, the latest on top
+    uint64_t raised{};
+
+    // Unmaps requested by xwmux, rather than the client (see WindowPane)
+    size_t unmap_req_count{};
+};
+
+class FloatingWindows {
+  public:
+    void add(const Window window, FloatingWindow floating) {
+        m_windows.insert_or_assign(window, floating);
+    }
+
+    void remove(const Window window) { m_windows.erase(window); }
+
+    bool has_window(const Window window) const {
+        return m_windows.contains(window);
+    }
+
+    FloatingWindow &get(const Window window) { return m_windows.at(window); }
+
+    // Put above the other overlays
+    void raise(const Window window) { get(window).raised = ++m_raises; }
+
+    // Shown overlay on top of those following an owner, which takes the
+    // input focus in its place
+    std::optional<Window> topmost(const Window owner) const {
+        std::optional<Window> ret;
+        uint64_t raised = 0;
+        for (const auto &[window, floating] : m_windows) {
+            if (floating.owner == owner && !floating.hidden &&
+                floating.raised >= raised) {
+                ret = window;
+                raised = floating.raised;
+            }
+        }
+        return ret;
+    }
+
+    // Windows centred over a parent
+    std::vector<Window> children(const Window parent) const {
+        std::vector<Window> ret;
+        for (const auto &[window, floating] : m_windows) {
+            if (floating.parent == parent) {
+                ret.push_back(window);
+            }
+        }
+        return ret;
+    }
+
+    std::unordered_map<Window, FloatingWindow> &get_windows() {
+        return m_windows;
+    }
+
+  private:
+    std::unordered_map<Window, FloatingWindow> m_windows;
+    uint64_t m_raises{};
+};
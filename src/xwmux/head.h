@@ -0,0 +1,75 @@
+/*
+ * A head is an output, with its own root terminal attached to its own tmux
+ * session, followed by its own control client, and its own layouts.
+ *
+ * Heads are kept by output name while xwmux runs. When an output is
+ * disconnected its terminal is closed and its windows are hidden, and its
+ * session is picked up again if the output comes back.
+ */
+
+#pragma once
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+
+#include <memory>
+#include <optional>
+#include <queue>
+#include <string>
+#include <utility>
+
+#include "floating.h"
+#include "layout.h"
+#include "outputs.h"
+#include "tmux.h"
+#include "tmux_control.h"
+
+struct Head {
+    Head(Display *const display, std::string session)
+        : session(std::move(session)), term_layout(display, Resolution()) {
+        if (this->session != TMUX_SESSION) {
+            m_own_control = std::make_unique<TmuxControl>(this->session);
+        }
+    }
+
+    // The first head's session is the one shared with the helpers
+    TmuxControl &control() {
+        return m_own_control ? *m_own_control : tmux_control();
+    }
+
+    bool connected() const { return output.has_value(); }
+
+    // Followed when the root terminal switches session
+    std::string session;
+
+    // Of the session, once the control client has attached to it
+    std::optional<TmuxSessionID> session_id;
+
+    // Unset while disconnected
+    std::optional<Output> output;
+
+    // A root terminal has been launched, and has not mapped yet
+    bool term_launching{};
+
+    WindowLayouts term_layout;
+    TmuxXWindowMapping mapping;
+
+    // Dialogs and the like, outside of tmux
+    FloatingWindows floating;
+
+    // Last known pane positions, to only move windows whose pane moved
+    TmuxLayouts layouts;
+
+    // Windows waiting for a pane in this head's session
+    std::queue<Window> window_q;
+
+    // Set by tmux notifications, handled once they have all been read
+    bool refresh{};
+
+    // A window was resized, maybe as the root terminal was resized or zoomed
+    bool check_size{};
+
+  private:
+    std::unique_ptr<TmuxControl> m_own_control;
+};
@@ -3,10 +3,21 @@
 #include "layout.h"
 #include "log.h"
 #include "tmux.h"
+#include "tmux_keys.h"
 
 #include <X11/X.h>
 #include <X11/Xlib.h>
 
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <format>
+#include <optional>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
+
 bool WMInstance::m_existing_wm = false;
 
 template <>
@@ -14,61 +25,131 @@ void WMInstance::handle_x_event<ConfigureNotify>(XConfigureEvent &ev) {
     if (ev.window == m_xstate.root) {
         m_xstate.set_resolution(
             {static_cast<size_t>(ev.width), static_cast<size_t>(ev.height)});
-        m_xstate.close_term();
+        update_outputs();
+    }
+}
+
+template <>
+void WMInstance::handle_x_event<CreateNotify>(XCreateWindowEvent &ev) {
+    // Read once the window is mapped
+    if (!ev.override_redirect) {
+        m_xstate.properties.prefetch(ev.window);
     }
 }
 
 template <> void WMInstance::handle_x_event<MapRequest>(XMapRequestEvent &ev) {
 
     Window w = ev.window;
-    if (m_xstate.override_redirect(w)) {
-    } else if (m_xstate.is_root_term(w)) {
-        m_xstate.resolution.fullscreen().resize_to(m_xstate.display, w);
-        XLowerWindow(m_xstate.display, w);
-        XMapWindow(m_xstate.display, w);
+    const WindowProperties &props = m_xstate.properties.get(w);
+    if (props.override_redirect) {
+    } else if (props.res_class == ROOT_CLASS) {
+        // Terminals are named after their session, where they allow it,
+        // otherwise they go to the first output without one
+        Head *head = nullptr;
+        for (auto &[output, candidate] : m_heads) {
+            if (!candidate.connected() || candidate.mapping.term()) {
+                continue;
+            }
+            if (candidate.session == props.res_name) {
+                head = &candidate;
+                break;
+            }
+            if (!head) {
+                head = &candidate;
+            }
+        }
+        if (!head) {
+            log_msg("Closing root terminal without an output\n");
+            m_xstate.close_term(w);
+            return;
+        }
+
+        head->term_launching = false;
+        head->mapping.set_term(w);
+        m_xstate.move_resize(w, head->output->area);
+        m_xstate.lower(w);
+        m_xstate.map(w);
         m_xstate.set_term(w);
-        m_xstate.focus_term();
+
+        // Focus follows the pointer between outputs
+        XSelectInput(m_xstate.display, w, PropertyChangeMask | EnterWindowMask);
+        if (head == m_focused) {
+            focus_term();
+        }
+    } else if (props.floating()) {
+        if (!head_of_float(w)) {
+            float_window(w, props);
+        }
     } else if (!m_pending_windows.count(w)) {
 
-        if (m_xstate.init_state(w).value_or(NormalState) != NormalState) {
+        if (props.initial_state.value_or(NormalState) != NormalState) {
             log_msg("Window started in iconic state\n");
         }
 
-        m_window_q.push(w);
-        m_pending_windows.insert(w);
-        split_window();
+        if (props.sync_counter.has_value()) {
+            m_xstate.set_sync_counter(w, props.sync_counter.value());
+        }
+
+        XSelectInput(m_xstate.display, w, PropertyChangeMask | EnterWindowMask);
 
-        // Watch for name changes
-        XSelectInput(m_xstate.display, w, PropertyChangeMask);
+        // Opened on the focused output
+        m_focused->window_q.push(w);
+        m_pending_windows.insert(w);
+        split_window(m_focused->control());
     }
 }
 
 template <> void WMInstance::handle_x_event<UnmapNotify>(XUnmapEvent &ev) {
-    if (m_tmux_mapping.has_window(ev.window)) {
-        WindowPane &wp = m_tmux_mapping.get(ev.window);
+    if (Head *head = head_of_float(ev.window)) {
+        FloatingWindow &floating = head->floating.get(ev.window);
+        if (floating.unmap_req_count) {
+            floating.unmap_req_count--;
+        } else {
+            m_xstate.forget(ev.window);
+            remove_float(*head, ev.window);
+        }
+    } else if (Head *head = head_of(ev.window)) {
+        WindowPane &wp = head->mapping.get(ev.window);
         if (wp.unmap_pending()) {
             wp.notify_unmapped();
         } else {
-            m_tmux_mapping.remove_window(ev.window);
-            m_xstate.focus_term();
+            m_xstate.forget(ev.window);
+            remove_window(*head, ev.window);
+            if (head == m_focused) {
+                focus_term();
+            }
         }
     } else {
+        m_xstate.forget(ev.window);
         m_pending_windows.erase(ev.window);
     }
 }
 
 template <>
 void WMInstance::handle_x_event<DestroyNotify>(XDestroyWindowEvent &ev) {
-    if (ev.window == m_xstate.term) {
-        m_xstate.term = {};
-        m_xstate.open_term();
-        m_xstate.focus_term();
-    } else if (!m_tmux_mapping.has_window(ev.window)) {
+    m_xstate.forget(ev.window);
+    m_xstate.properties.erase(ev.window);
+    if (Head *head = head_of_term(ev.window)) {
+        head->mapping.set_term({});
+        forget_term_client();
+
+        // Not relaunched once the output is gone
+        if (head->connected()) {
+            open_term(*head);
+        }
+        if (head == m_focused) {
+            focus_term();
+        }
+    } else if (Head *head = head_of(ev.window)) {
+        remove_window(*head, ev.window);
+        if (head == m_focused) {
+            focus_term();
+        }
+    } else if (Head *head = head_of_float(ev.window)) {
+        remove_float(*head, ev.window);
+    } else {
         m_pending_windows.erase(ev.window);
         // Not focused yet, do not focus terminal
-    } else {
-        m_tmux_mapping.remove_window(ev.window);
-        m_xstate.focus_term();
     }
 }
 
@@ -79,42 +160,43 @@ template <> void WMInstance::handle_x_event<KeyPress>(XEvent &ev) {
         // Release the active grab, and generate focus in event
         XUngrabKeyboard(m_xstate.display, CurrentTime);
 
+        TmuxXWindowMapping &mapping = m_focused->mapping;
+
         // If terminal is focused (prefix active), overriding gui,
         // redirect the event to the gui window
-        if (m_tmux_mapping.overridden()) {
+        if (mapping.overridden()) {
 
-            if (std::system("tmux send-keys -K escape")) {
-                log_msg("Failed to send escape.\n");
-            };
+            send_keys("escape");
 
-            m_tmux_mapping.release_override(m_xstate);
+            mapping.release_override(m_xstate);
+            std::optional<Window> overlay = focus_floating(*m_focused);
 
-            // Send to current window
+            // Send to current window (or a dialog over it)
             k_ev.display = m_xstate.display;
             k_ev.root = XDefaultRootWindow(m_xstate.display);
             k_ev.same_screen = True;
             k_ev.time = CurrentTime;
             k_ev.subwindow = None;
-            k_ev.window = m_tmux_mapping.current_window();
+            k_ev.window = overlay.value_or(mapping.current_window());
             XSendEvent(m_xstate.display, k_ev.window, 0, 0, &ev);
             return;
         }
 
-        if (!m_xstate.term.has_value()) {
+        if (!mapping.term().has_value()) {
             return;
         }
 
         // If gui has focus, move to terminal, send prefix and mark
         // overridden
-        if (m_tmux_mapping.is_filled()) {
+        if (mapping.is_filled()) {
 
             // Focus terminal, ignore incoming focus notifications
             // to avoid WMInstance::re-focusing gui window
             m_ignore_focus = true;
-            m_xstate.focus_term();
+            focus_term();
             m_ignore_focus = false;
 
-            m_tmux_mapping.override();
+            mapping.override();
         }
 
         // Ensure tmux gets focus
@@ -126,44 +208,122 @@ template <> void WMInstance::handle_x_event<KeyPress>(XEvent &ev) {
 
 template <>
 void WMInstance::handle_x_event<PropertyNotify>(XPropertyEvent &ev) {
-    if (m_tmux_mapping.has_window(ev.window) &&
-        ev.atom == XInternAtom(m_xstate.display, "WM_NAME", 0)) {
-        TmuxPaneID pane = m_tmux_mapping.find(ev.window).second;
+    // Read again when next needed
+    PropertyCache::Field field =
+        m_xstate.properties.invalidate(ev.window, ev.atom);
+    Head *head = head_of(ev.window);
+    if (!head) {
+        return;
+    }
+    if (field == PropertyCache::SIZE_HINTS) {
+        position_pane(*head, head->mapping.find(ev.window));
+    } else if (field == PropertyCache::TITLE) {
+        TmuxPaneID pane = head->mapping.find(ev.window).second;
         name_client(ev.window, pane);
     }
 }
 
+template <>
+void WMInstance::handle_x_event<EnterNotify>(XCrossingEvent &ev) {
+    // Not for crossings caused by grabs
+    if (ev.mode != NotifyNormal) {
+        return;
+    }
+    Head *head = head_of_term(ev.window);
+    if (!head) {
+        head = head_of(ev.window);
+    }
+    if (!head) {
+        head = head_of_float(ev.window);
+    }
+    if (head) {
+        focus_head(*head);
+    }
+}
+
+template <>
+void WMInstance::handle_x_event<ConfigureRequest>(XConfigureRequestEvent &ev) {
+    if (Head *head = head_of_float(ev.window)) {
+        // Overlays choose their size, but not their place
+        FloatingWindow &floating = head->floating.get(ev.window);
+        if (ev.value_mask & CWWidth) {
+            floating.size.x = ev.width;
+        }
+        if (ev.value_mask & CWHeight) {
+            floating.size.y = ev.height;
+        }
+        place_float(*head, ev.window);
+    } else if (!head_of(ev.window) && !head_of_term(ev.window)) {
+        // Not managed (yet), so configured as asked
+        XWindowChanges changes{
+            .x = ev.x,
+            .y = ev.y,
+            .width = ev.width,
+            .height = ev.height,
+            .border_width = ev.border_width,
+            .sibling = ev.above,
+            .stack_mode = ev.detail,
+        };
+        XConfigureWindow(m_xstate.display, ev.window, ev.value_mask,
+                         &changes);
+        m_xstate.properties.mark_stale(ev.window, PropertyCache::GEOMETRY);
+    }
+}
+
 template <>
 void WMInstance::handle_client_msg<MsgType::RESOLUTION>(const Msg &msg) {
-    m_xstate.term_layout.set_term_resolution(msg.res_chars(), msg.res_px());
+    // Sent from within a root terminal, naming its session
+    Head *head = m_focused;
+    if (msg.session() != None) {
+        char *name = XGetAtomName(m_xstate.display,
+                                  static_cast<Atom>(msg.session()));
+        for (auto &[output, candidate] : m_heads) {
+            if (name && candidate.session == name) {
+                head = &candidate;
+            }
+        }
+        if (name) {
+            XFree(name);
+        }
+    }
 
-    m_xstate.term_layout.set_bar_position(
-        static_cast<TmuxBarPosition>(msg.bar_pos()));
+    init_head(*head, msg.res_chars(), msg.res_px(),
+              static_cast<TmuxBarPosition>(msg.bar_pos()));
+}
+
+void WMInstance::init_head(Head &head, const Resolution res_chars,
+                           const Resolution res_px,
+                           const TmuxBarPosition bar_pos) {
+    head.term_layout.set_term_resolution(res_chars, res_px);
+    head.term_layout.set_bar_position(bar_pos);
+
+    // Pane positions on screen have changed
+    head.layouts.clear();
+
+    // The session exists by now, follow it
+    head.control().connect();
+    head.refresh = true;
+
+    // Its terminal is attached by now, keys need its client
+    update_term_client(head.session);
 }
 
 template <>
 void WMInstance::handle_client_msg<MsgType::PREFIX>(const Msg &msg) {
     m_xstate.set_prefix(msg.mod_kc());
+    update_prefix();
 }
 
 template <>
 void WMInstance::handle_client_msg<MsgType::KILL_PANE>(const Msg &msg) {
     (void)msg;
-    if (m_tmux_mapping.is_filled()) {
-        Window w = m_tmux_mapping.current_window();
-        m_tmux_mapping.kill_client(w, m_xstate.display);
-        m_tmux_mapping.remove_window(w);
-    }
-    // Pane should be killed normally on unmap notify.
+    kill_focused();
 }
 
 template <>
 void WMInstance::handle_client_msg<MsgType::KILL_ORPHANS>(const Msg &msg) {
     (void)msg;
-    for (Window w : m_tmux_mapping.find_orphans()) {
-        m_tmux_mapping.kill_client(w, m_xstate.display);
-        m_tmux_mapping.remove_window(w);
-    }
+    kill_orphans();
 }
 
 template <> void WMInstance::handle_client_msg<MsgType::EXIT>(const Msg &msg) {
@@ -173,67 +333,224 @@ template <> void WMInstance::handle_client_msg<MsgType::EXIT>(const Msg &msg) {
 
 template <>
 void WMInstance::handle_client_msg<MsgType::TMUX_POSITION>(const Msg &msg) {
-    m_tmux_mapping.move_pane(msg.tm_location());
+    TmuxPaneReport report = msg.pane_report();
+    update_pane(head_of_report(report), report);
+}
 
-    if (msg.focused() && !m_ignore_focus) {
+template <>
+void WMInstance::handle_client_msg<MsgType::TMUX_SNAPSHOT>(const Msg &msg) {
+    (void)msg;
+    for (const TmuxPaneReport &pane : read_snapshot(m_xstate.display)) {
+        update_pane(head_of_report(pane), pane);
+    }
+}
 
-        // Have window to add
-        if (!m_window_q.empty() &&
-            !m_tmux_mapping.is_filled(msg.tm_location()) && msg.dead()) {
+template <>
+void WMInstance::handle_x_event<ClientMessage>(XClientMessageEvent &ev) {
+    // Handlers indexed by MsgType
+    using Handler = void (WMInstance::*)(const Msg &);
+    static constexpr auto handlers =
+        []<std::size_t... I>(std::index_sequence<I...>) {
+            return std::array<Handler, MSG_TYPE_COUNT>{
+                &WMInstance::handle_client_msg<static_cast<MsgType>(I)>...};
+        }(std::make_index_sequence<MSG_TYPE_COUNT>());
 
-            Window window = m_window_q.front();
-            m_window_q.pop();
+    if (ev.message_type == atoms(m_xstate.display)[AtomID::NET_WM_STATE]) {
+        handle_net_wm_state(ev);
+        return;
+    }
 
-            // Already destroyed or window already mapped, so kill the pane
-            // TODO: avoid WMInstance::adding to queue twice instead?
-            if (!m_pending_windows.count(window) ||
-                m_tmux_mapping.has_window(window)) {
-                kill_pane(msg.tm_location().second);
+    std::optional<MsgType> type =
+        atom_msg_type(m_xstate.display, ev.message_type);
+    if (type.has_value()) {
+        (this->*handlers[static_cast<std::size_t>(type.value())])(Msg{ev});
+    }
+}
 
-            } else {
-                m_tmux_mapping.add_window(m_xstate, window, msg.tm_location());
-                m_pending_windows.erase(window);
-                name_client(window, msg.tm_location().second);
+void WMInstance::handle_net_wm_state(const XClientMessageEvent &ev) {
+    // "<action> <first property> <second property> <source>"
+    enum Action : long { REMOVE, ADD, TOGGLE };
+    const Atom fullscreen =
+        atoms(m_xstate.display)[AtomID::NET_WM_STATE_FULLSCREEN];
+    if (static_cast<Atom>(ev.data.l[1]) != fullscreen &&
+        static_cast<Atom>(ev.data.l[2]) != fullscreen) {
+        return;
+    }
+
+    Head *head = head_of(ev.window);
+    if (!head) {
+        head = head_of_float(ev.window);
+    }
+    if (!head) {
+        return;
+    }
+    switch (ev.data.l[0]) {
+    case REMOVE:
+        set_fullscreen(*head, ev.window, false);
+        break;
+    case ADD:
+        set_fullscreen(*head, ev.window, true);
+        break;
+    case TOGGLE:
+        set_fullscreen(*head, ev.window, !m_xstate.is_fullscreen(ev.window));
+        break;
+    default:
+        break;
+    }
+}
+
+// The same commands as xwmux-ctl sends as client messages, and more, as
+// requests may carry any amount of data and get a reply
+ControlReply WMInstance::handle_request(const ControlRequest &request) {
+    const std::vector<std::string> &args = request.args;
+    const std::string_view cmd = args[0];
+    const ControlReply ok{.ok = true};
+    const ControlReply bad_args{.ok = false,
+                                .output = std::string(CONTROL_BAD_ARGS)};
+
+    auto number = [](const std::string_view arg) -> std::optional<size_t> {
+        size_t ret;
+        auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(),
+                                         ret);
+        if (ec != std::errc() || ptr != arg.data() + arg.size()) {
+            return std::nullopt;
+        }
+        return ret;
+    };
+
+    if (cmd == "init") {
+        // "init <rows> <cols> <px_w> <px_h> <bar-position> [<session>]"
+        if (args.size() != 6 && args.size() != 7) {
+            return bad_args;
+        }
+        std::optional<size_t> rows = number(args[1]), cols = number(args[2]),
+                              px_w = number(args[3]), px_h = number(args[4]);
+        if (!rows || !cols || !px_w || !px_h ||
+            (args[5] != "top" && args[5] != "bottom")) {
+            return bad_args;
+        }
+        Head *head = args.size() == 7 ? head_of_session(args[6]) : nullptr;
+        init_head(head ? *head : *m_focused, {cols.value(), rows.value()},
+                  {px_w.value(), px_h.value()},
+                  args[5] == "top" ? TmuxBarPosition::TOP
+                                   : TmuxBarPosition::BOTTOM);
+        return ok;
+
+    } else if (cmd == "prefix") {
+        if (args.size() != 2) {
+            return bad_args;
+        }
+        m_xstate.set_prefix(tmux_to_keycode(m_xstate.display, args[1]));
+        update_prefix();
+        return ok;
+
+    } else if (cmd == "exit") {
+        // After the reply is sent
+        m_stop = true;
+        return ok;
+
+    } else if (cmd == "kill-pane") {
+        // "kill-pane [ %<pane-id> | focused | orphans ]"
+        if (args.size() != 2) {
+            return bad_args;
+        }
+        if (args[1] == "orphans") {
+            kill_orphans();
+            return ok;
+        }
+        if (args[1] == "focused") {
+            kill_focused();
+            return ok;
+        }
+        std::optional<size_t> tm_pane =
+            args[1].starts_with('%') ? number(args[1].substr(1)) : std::nullopt;
+        if (!tm_pane) {
+            return bad_args;
+        }
+        for (auto &[output, head] : m_heads) {
+            for (auto &[tm_window, workspace] : head.mapping.get_workspaces()) {
+                auto it = workspace.get_windows().find(tm_pane.value());
+                if (it != workspace.get_windows().end()) {
+                    Window w = it->second.get_window();
+                    head.mapping.kill_client(w, m_xstate.display);
+                    remove_window(head, w);
+                    return ok;
+                }
             }
         }
+        return {.ok = false, .output = "No window in pane\n"};
 
-        m_tmux_mapping.set_active(m_xstate, msg.tm_location(), msg.zoomed());
-    }
+    } else if (cmd == "tmux-position") {
+        // As for client messages, the session ID moved to the end as in
+        // PANE_REPORT_FORMAT
+        if (args.size() != 11) {
+            return bad_args;
+        }
+        std::string line = std::format(
+            "{} {} {} {} {} {} {} {} {} {}", args[1], args[2], args[4],
+            args[5], args[6], args[7], args[8], args[9], args[10], args[3]);
+        std::optional<TmuxPaneReport> report = TmuxPaneReport::parse(line);
+        if (!report.has_value() || !report->session.has_value()) {
+            return bad_args;
+        }
+        update_pane(head_of_report(report.value()), report.value());
+        return ok;
 
-    // set_position(msg.tm_location(), msg.window_position());
-    // Moves the (possible window) at location to term_position
-    // If pane doesn't have a window, do nothing
-    // If pane is in seperate window, moves the pane
-    WindowPosition gui_position = m_xstate.term_layout.term_to_screen_pos(
-        m_xstate.term_layout.add_bar(msg.window_position()));
+    } else if (cmd == "report") {
+        // "report [ $<session-id> | <session> ]", panes in PANE_REPORT_FORMAT
+        // one per line, otherwise xwmux asks tmux itself for the session's
+        if (args.size() > 2) {
+            return bad_args;
+        }
+        if (request.payload.empty()) {
+            if (args.size() != 2) {
+                return {.ok = false, .output = "No session given\n"};
+            }
+            std::optional<size_t> session_id =
+                args[1].starts_with('$') ? number(args[1].substr(1))
+                                         : std::nullopt;
+            Head *head = session_id.has_value()
+                             ? head_of_session_id(
+                                   static_cast<TmuxSessionID>(session_id.value()))
+                             : head_of_session(args[1]);
+            if (!head) {
+                return {.ok = false, .output = "No output for session\n"};
+            }
+            head->refresh = true;
+            return ok;
+        }
+        std::vector<std::string> lines;
+        std::string_view payload = request.payload;
+        while (!payload.empty()) {
+            size_t end = payload.find('\n');
+            lines.emplace_back(payload.substr(0, end));
+            payload.remove_prefix(end == std::string_view::npos ? payload.size()
+                                                                : end + 1);
+        }
+        for (const TmuxPaneReport &pane : parse_pane_reports(lines)) {
+            update_pane(head_of_report(pane), pane);
+        }
+        return ok;
 
-    if (m_tmux_mapping.is_filled(msg.tm_location())) {
-        m_tmux_mapping[msg.tm_location()].set_position(m_xstate, gui_position);
+    } else if (cmd == "status") {
+        // "<output> <session> <connected> <panes with windows> <overlays>",
+        // focused output first
+        std::string output;
+        for (auto &[name, head] : m_heads) {
+            size_t windows = 0;
+            for (auto &[tm_window, workspace] : head.mapping.get_workspaces()) {
+                windows += workspace.get_windows().size();
+            }
+            std::string line = std::format(
+                "{} {} {} {} {}\n", name, head.session,
+                head.connected() ? "connected" : "disconnected", windows,
+                head.floating.get_windows().size());
+            output.insert(&head == m_focused ? 0 : output.size(), line);
+        }
+        return {.ok = true, .output = output};
     }
-}
 
-template <>
-void WMInstance::handle_x_event<ClientMessage>(XClientMessageEvent &ev) {
-    const Msg msg{ev};
-    if (ev.message_type ==
-        msg_type_atom(m_xstate.display, MsgType::RESOLUTION)) {
-        handle_client_msg<MsgType::RESOLUTION>(msg);
-    } else if (ev.message_type ==
-               msg_type_atom(m_xstate.display, MsgType::PREFIX)) {
-        handle_client_msg<MsgType::PREFIX>(msg);
-    } else if (ev.message_type ==
-               msg_type_atom(m_xstate.display, MsgType::EXIT)) {
-        handle_client_msg<MsgType::EXIT>(msg);
-    } else if (ev.message_type ==
-               msg_type_atom(m_xstate.display, MsgType::KILL_PANE)) {
-        handle_client_msg<MsgType::KILL_PANE>(msg);
-    } else if (ev.message_type ==
-               msg_type_atom(m_xstate.display, MsgType::KILL_ORPHANS)) {
-        handle_client_msg<MsgType::KILL_ORPHANS>(msg);
-    } else if (ev.message_type ==
-               msg_type_atom(m_xstate.display, MsgType::TMUX_POSITION)) {
-        handle_client_msg<MsgType::TMUX_POSITION>(msg);
-    }
+    return {.ok = false, .output = std::string(CONTROL_UNKNOWN)};
 }
 
 void WMInstance::handle_event(XEvent &ev) {
@@ -241,9 +558,18 @@ void WMInstance::handle_event(XEvent &ev) {
     case ConfigureNotify:
         handle_x_event<ConfigureNotify>(ev.xconfigure);
         break;
+    case CreateNotify:
+        handle_x_event<CreateNotify>(ev.xcreatewindow);
+        break;
     case MapRequest:
         handle_x_event<MapRequest>(ev.xmaprequest);
         break;
+    case ConfigureRequest:
+        handle_x_event<ConfigureRequest>(ev.xconfigurerequest);
+        break;
+    case EnterNotify:
+        handle_x_event<EnterNotify>(ev.xcrossing);
+        break;
     case UnmapNotify:
         handle_x_event<UnmapNotify>(ev.xunmap);
         break;
@@ -261,7 +587,517 @@ void WMInstance::handle_event(XEvent &ev) {
     case PropertyNotify:
         handle_x_event<PropertyNotify>(ev.xproperty);
         break;
+    default:
+        // Extension events have no fixed type
+        if (m_xstate.has_sync &&
+            ev.type == m_xstate.sync_event_base + XSyncAlarmNotify) {
+            m_xstate.sync_done(
+                reinterpret_cast<XSyncAlarmNotifyEvent &>(ev).alarm);
+        } else if (m_xstate.outputs.is_event(ev)) {
+            m_xstate.outputs.update_configuration(ev);
+            update_outputs();
+        }
+        break;
+    }
+}
+
+// Events with the same key only matter for the state they leave behind, so
+// only the last is handled
+static std::optional<std::tuple<int, unsigned long, long>>
+coalesce_key(Display *dpy, const Outputs &outputs, const XEvent &ev) {
+    // Outputs are all queried again on any RandR event, but each type also
+    // updates Xlib's own screen configuration
+    if (outputs.is_event(ev)) {
+        return std::tuple{ev.type, 0, 0};
+    }
+
+    switch (ev.type) {
+    case ConfigureNotify:
+        if (ev.xconfigure.window == XDefaultRootWindow(dpy)) {
+            return std::tuple{ev.type, ev.xconfigure.window, 0};
+        }
+        break;
+    case PropertyNotify:
+        return std::tuple{ev.type, ev.xproperty.window, ev.xproperty.atom};
+    case ClientMessage:
+        if (atom_msg_type(dpy, ev.xclient.message_type) ==
+            MsgType::TMUX_POSITION) {
+            return std::tuple{ev.type, 0, Msg{ev.xclient}.tm_pane()};
+        }
+        break;
     default:
         break;
     }
+    return std::nullopt;
+}
+
+void WMInstance::handle_events() {
+    std::vector<XEvent> events;
+    while (XPending(m_xstate.display)) {
+        XNextEvent(m_xstate.display, &events.emplace_back());
+    }
+
+    // Find the last event for each key
+    std::set<std::tuple<int, unsigned long, long>> seen;
+    std::vector<bool> superseded(events.size());
+    for (size_t i = events.size(); i-- > 0;) {
+        auto key = coalesce_key(m_xstate.display, m_xstate.outputs, events[i]);
+        if (key.has_value() && !seen.insert(key.value()).second) {
+            superseded[i] = true;
+        }
+    }
+
+    for (size_t i = 0; i < events.size(); i++) {
+        if (!superseded[i]) {
+            handle_event(events[i]);
+        }
+    }
+    XFlush(m_xstate.display);
+}
+
+void WMInstance::handle_positions() {
+    std::vector<TmuxPaneReport> reports = m_positions.drain();
+
+    // Only the last report of each pane matters, as with client messages
+    std::unordered_set<TmuxPaneID> seen;
+    std::vector<bool> superseded(reports.size());
+    for (size_t i = reports.size(); i-- > 0;) {
+        superseded[i] = !seen.insert(reports[i].location.second).second;
+    }
+
+    for (size_t i = 0; i < reports.size(); i++) {
+        if (!superseded[i]) {
+            update_pane(head_of_report(reports[i]), reports[i]);
+        }
+    }
+}
+
+void WMInstance::handle_tmux_notifications() {
+    for (auto &[output, head] : m_heads) {
+        while (std::optional<std::string> notification =
+                   head.control().next_notification()) {
+            handle_tmux_notification(head, notification.value());
+        }
+    }
+
+    if (m_tmux_orphans) {
+        m_tmux_orphans = false;
+        kill_orphans();
+    }
+
+    for (auto &[output, head] : m_heads) {
+        if (head.check_size) {
+            head.check_size = false;
+            query_term_size(
+                head.session, [this, &head](const Resolution chars,
+                                            const Resolution cell) {
+                    // Every pane has moved on screen
+                    if (head.term_layout.resize_term(chars, cell)) {
+                        head.layouts.clear();
+                        head.refresh = true;
+                    }
+                });
+        }
+
+        if (!head.refresh) {
+            continue;
+        }
+        head.refresh = false;
+        query_panes(head.control(),
+                    [this, &head](const std::vector<TmuxPaneReport> &panes) {
+                        for (const TmuxPaneReport &pane : panes) {
+                            update_pane(head, pane);
+                        }
+                    });
+    }
+}
+
+void WMInstance::handle_tmux_notification(
+    Head &head, const std::string_view notification) {
+    std::vector<std::string_view> args;
+    for (size_t start = 0, end = 0; end != std::string_view::npos;
+         start = end + 1) {
+        end = notification.find(' ', start);
+        args.push_back(notification.substr(start, end - start));
+    }
+    std::string_view name = args[0];
+
+    if (name == "%layout-change" && args.size() >= 3) {
+        // "%layout-change @<window-id> <layout> [<visible-layout> <flags>]"
+        TmuxWindowID tm_window = std::atoi(args[1].data() + 1);
+        // Resizes are handled by the diff alone, other changes need the
+        // panes' state from tmux, and panes may have been killed
+        if (update_layout(head, tm_window,
+                          args.size() >= 4 ? args[3] : args[2])) {
+            m_tmux_orphans = true;
+            head.refresh = true;
+        }
+    } else if (name == "%window-close" || name == "%unlinked-window-close") {
+        if (args.size() >= 2) {
+            head.layouts.erase(std::atoi(args[1].data() + 1));
+        }
+        m_tmux_orphans = true;
+        head.refresh = true;
+    } else if (name == "%window-pane-changed" ||
+               name == "%session-window-changed" ||
+               name == "%session-changed" || name == "%window-add" ||
+               name == "%unlinked-window-add") {
+        // "%session-changed $<session-id> <name>", also sent on attach
+        if (name == "%session-changed" && args.size() >= 2) {
+            head.session_id = std::atoi(args[1].data() + 1);
+        }
+        head.refresh = true;
+    } else if (name == "%client-detached") {
+        forget_term_client();
+    } else if (name == "%client-session-changed" && args.size() >= 4 &&
+               &head.control() == &tmux_control()) {
+        // "%client-session-changed <client> <session-id> <name>"
+        // Every control client is told, so only the first head's handles it
+        std::string client(args[1]);
+        std::string session_id(args[2]);
+        std::string session(args[3]);
+
+        // Control clients switch session when following a root terminal
+        query_control_mode(client, [this, client, session_id,
+                                    session](bool control_mode) {
+            if (control_mode) {
+                return;
+            }
+            Head *target = m_focused;
+            for (auto &[output, candidate] : m_heads) {
+                if (is_term_client(candidate.session, client)) {
+                    target = &candidate;
+                }
+            }
+            if (!target) {
+                return;
+            }
+            forget_term_client();
+            target->session = session;
+            follow_session(target->control(), session_id);
+            if (target == m_focused) {
+                focus_session(session);
+            }
+            for (auto &[output, candidate] : m_heads) {
+                update_term_client(candidate.session);
+            }
+        });
+    }
+}
+
+void WMInstance::update_pane(Head &head, const TmuxPaneReport &report) {
+    TmuxXWindowMapping &mapping = head.mapping;
+    mapping.move_pane(report.location);
+    bool added = false;
+
+    if (report.focused && !m_ignore_focus) {
+
+        // Have window to add
+        if (!head.window_q.empty() && !mapping.is_filled(report.location) &&
+            report.dead) {
+
+            Window window = head.window_q.front();
+            head.window_q.pop();
+
+            // Already destroyed or window already mapped, so kill the pane
+            // TODO: avoid WMInstance::adding to queue twice instead?
+            if (!m_pending_windows.count(window) || head_of(window)) {
+                kill_pane(report.location.second);
+
+            } else {
+                mapping.add_window(
+                    m_xstate, window, report.location,
+                    m_xstate.fit(head.term_layout, window,
+                                 head.term_layout.fullscreen_term_position()));
+                m_pending_windows.erase(window);
+                name_client(window, report.location.second);
+                added = true;
+
+                // Asked for before mapping, e.g. by video players
+                if (m_xstate.properties.get(window).fullscreen) {
+                    set_fullscreen(head, window, true);
+                }
+            }
+        }
+
+        std::optional<TmuxLocation> active = mapping.get_active();
+        mapping.set_active(m_xstate, report.location, report.zoomed);
+
+        // Dialogs shown again, or over the newly active pane, keep their
+        // input focus
+        if (update_floating(head) || mapping.get_active() != active) {
+            focus_floating(head);
+        }
+    }
+
+    // New windows start out fullscreen, so always need moving
+    if (head.layouts.update(report.location.first, report.location.second,
+                            report.position) ||
+        added) {
+        position_pane(head, report.location);
+    }
+}
+
+bool WMInstance::update_layout(Head &head, const TmuxWindowID tm_window,
+                               const std::string_view layout) {
+    std::optional<TmuxLayoutCell> cell = TmuxLayoutCell::parse(layout);
+    if (!cell.has_value()) {
+        log_msg(std::format("Bad layout: {}\n", layout));
+        return true;
+    }
+    bool panes_changed = !head.layouts.same_panes(tm_window, cell.value());
+
+    // Windows follow the size of the root terminal
+    const WindowPosition &area = cell->position;
+    if (head.layouts.size(tm_window) !=
+        Point{.x = area.end.x - area.start.x, .y = area.end.y - area.start.y}) {
+        head.check_size = true;
+    }
+
+    for (TmuxPaneID tm_pane :
+         head.layouts.update(tm_window, std::move(cell.value()))) {
+        position_pane(head, {tm_window, tm_pane});
+    }
+    return panes_changed;
+}
+
+void WMInstance::position_pane(Head &head, const TmuxLocation location) {
+    // Moves the (possible window) at location to term_position
+    // If pane doesn't have a window, do nothing
+    // If pane is in seperate window, moves the pane
+    std::optional<WindowPosition> gui_position = pane_area(head, location);
+    if (!gui_position.has_value() || !head.mapping.is_filled(location)) {
+        return;
+    }
+
+    Window window = head.mapping[location].get_window();
+    m_resizes.update(window, m_xstate.fit(head.term_layout, window,
+                                          gui_position.value()));
+
+    // Overlays follow the pane
+    for (Window child : head.floating.children(window)) {
+        place_float(head, child);
+    }
+}
+
+std::optional<WindowPosition>
+WMInstance::pane_area(Head &head, const TmuxLocation location) {
+    std::optional<WindowPosition> position =
+        head.layouts.find(location.first, location.second);
+    if (!position.has_value()) {
+        return std::nullopt;
+    }
+    return head.term_layout.term_to_screen_pos(
+        head.term_layout.add_bar(position.value()));
+}
+
+void WMInstance::float_window(const Window window,
+                              const WindowProperties &props) {
+    // Kept with the window it belongs to, otherwise on the focused output
+    Head *head = m_focused;
+    FloatingWindow floating{.parent = props.transient_for,
+                            .size = props.size};
+    if (props.transient_for.has_value()) {
+        const Window parent = props.transient_for.value();
+        if (Head *owner = head_of(parent)) {
+            head = owner;
+            floating.owner = parent;
+        } else if (Head *owner = head_of_float(parent)) {
+            head = owner;
+            floating.owner = owner->floating.get(parent).owner;
+        } else if (Head *owner = head_of_term(parent)) {
+            head = owner;
+        }
+    }
+
+    // Mapped once its owner is shown
+    floating.hidden = float_hidden(*head, floating);
+    head->floating.add(window, floating);
+    head->floating.raise(window);
+    m_xstate.set_floating(window);
+    XSelectInput(m_xstate.display, window,
+                 PropertyChangeMask | EnterWindowMask);
+    place_float(*head, window);
+    if (!floating.hidden) {
+        m_xstate.map(window);
+        if (head == m_focused) {
+            m_xstate.focus(window);
+        }
+    }
+    if (props.fullscreen) {
+        set_fullscreen(*head, window, true);
+    }
+}
+
+void WMInstance::place_float(Head &head, const Window window) {
+    if (!head.connected()) {
+        return;
+    }
+    const FloatingWindow &floating = head.floating.get(window);
+    const WindowPosition &output = head.output->area;
+
+    std::optional<WindowPosition> over;
+    if (floating.parent.has_value()) {
+        const Window parent = floating.parent.value();
+        if (head.mapping.has_window(parent)) {
+            over = pane_area(head, head.mapping.find(parent));
+        } else if (auto it = m_xstate.shadow.find(parent);
+                   it != m_xstate.shadow.end()) {
+            over = it->second.position;
+        }
+    }
+    m_xstate.move_resize(window,
+                         over.value_or(output).centre(floating.size, output));
+}
+
+bool WMInstance::float_hidden(Head &head, const FloatingWindow &floating) {
+    if (!head.connected()) {
+        return true;
+    }
+    return floating.owner.has_value() &&
+           head.mapping.has_window(floating.owner.value()) &&
+           head.mapping.is_hidden(floating.owner.value());
+}
+
+bool WMInstance::update_floating(Head &head) {
+    std::vector<std::pair<uint64_t, Window>> shown;
+    for (auto &[window, floating] : head.floating.get_windows()) {
+        bool hidden = float_hidden(head, floating);
+        if (hidden == floating.hidden) {
+            continue;
+        }
+        floating.hidden = hidden;
+        if (hidden) {
+            if (m_xstate.hide(window)) {
+                floating.unmap_req_count++;
+            }
+        } else {
+            shown.emplace_back(floating.raised, window);
+        }
+    }
+
+    // Raised in their previous order
+    std::sort(shown.begin(), shown.end());
+    for (auto [raised, window] : shown) {
+        m_xstate.show(window);
+        m_xstate.raise(window);
+    }
+    m_xstate.restack();
+    return !shown.empty();
+}
+
+std::optional<Window> WMInstance::focus_floating(Head &head) {
+    TmuxXWindowMapping &mapping = head.mapping;
+    if (&head != m_focused || mapping.overridden() || !mapping.is_filled()) {
+        return std::nullopt;
+    }
+    std::optional<Window> overlay =
+        head.floating.topmost(mapping.current_window());
+    if (overlay.has_value()) {
+        m_xstate.focus(overlay.value());
+    }
+    return overlay;
+}
+
+void WMInstance::remove_float(Head &head, const Window window) {
+    head.floating.remove(window);
+
+    // Back to the pane (or terminal) below, or another dialog over it
+    if (&head == m_focused) {
+        head.mapping.set_focused(m_xstate, true);
+        focus_floating(head);
+    }
+}
+
+void WMInstance::set_fullscreen(Head &head, const Window window,
+                                const bool fullscreen) {
+    if (!fullscreen) {
+        m_xstate.unset_fullscreen(window);
+    } else if (head.connected()) {
+        m_xstate.set_fullscreen(window, head.output->area);
+    }
+}
+
+void WMInstance::kill_focused() {
+    TmuxXWindowMapping &mapping = m_focused->mapping;
+    if (mapping.is_filled()) {
+        Window w = mapping.current_window();
+        mapping.kill_client(w, m_xstate.display);
+        remove_window(*m_focused, w);
+    }
+    // Pane should be killed normally on unmap notify.
+}
+
+void WMInstance::kill_orphans() {
+    query_pane_ids([this](const std::vector<TmuxPaneID> &live_panes) {
+        for (auto &[output, head] : m_heads) {
+            for (Window w : head.mapping.find_orphans(live_panes)) {
+                head.mapping.kill_client(w, m_xstate.display);
+                remove_window(head, w);
+            }
+        }
+    });
+}
+
+void WMInstance::update_outputs() {
+    std::vector<Output> outputs = m_xstate.outputs.query(m_xstate.resolution);
+
+    for (const Output &output : outputs) {
+        // The first head shares its session with the helper scripts
+        auto [it, created] = m_heads.try_emplace(
+            output.name, m_xstate.display,
+            m_heads.empty() ? TMUX_SESSION
+                            : std::format("{}-{}", TMUX_SESSION, output.name));
+        Head &head = it->second;
+
+        bool moved = !head.output.has_value() ||
+                     head.output->area != output.area;
+        head.output = output;
+        if (!moved) {
+            continue;
+        }
+
+        head.term_layout.set_screen_area(output.area);
+        head.layouts.clear();
+        for (auto &[window, floating] : head.floating.get_windows()) {
+            place_float(head, window);
+        }
+
+        // Fullscreen windows follow the output, not their panes
+        for (auto &[id, window] : m_xstate.shadow) {
+            if (window.fullscreen &&
+                (head.mapping.has_window(id) || head.floating.has_window(id))) {
+                m_xstate.set_fullscreen(id, output.area);
+            }
+        }
+
+        // The terminal is resized in place, and its new grid is read from
+        // tmux once the session's windows have followed it
+        if (head.mapping.term().has_value()) {
+            m_xstate.move_resize(head.mapping.term().value(), output.area);
+            head.refresh = true;
+            head.check_size = true;
+        } else {
+            open_term(head);
+        }
+    }
+
+    for (auto &[name, head] : m_heads) {
+        bool gone = std::none_of(
+            outputs.begin(), outputs.end(),
+            [&name](const Output &output) { return output.name == name; });
+        if (!gone || !head.connected()) {
+            continue;
+        }
+        head.output.reset();
+        head.mapping.hide_all(m_xstate);
+        update_floating(head);
+        if (head.mapping.term().has_value()) {
+            m_xstate.close_term(head.mapping.term().value());
+        }
+    }
+
+    if (!m_focused || !m_focused->connected()) {
+        focus_head(m_heads.at(outputs.front().name));
+    }
 }
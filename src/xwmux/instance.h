@@ -9,20 +9,37 @@ extern "C" {
 #include <X11/cursorfont.h>
 }
 
+#include <array>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
-#include <queue>
+#include <map>
+#include <string>
 #include <unordered_set>
+#include <vector>
 
+#include "control_server.h"
+#include "executor.h"
+#include "head.h"
 #include "ipc.h"
+#include "launcher.h"
+#include "poller.h"
+#include "position_ring.h"
+#include "resize_debouncer.h"
+#include "timers.h"
+#include "title_sync.h"
 #include "tmux.h"
 
 constexpr void notify(std::string_view msg) {
-    if (std::system(std::format("notify-send '{}'", msg).c_str())) {
-        // Fallback: send via tmux
-        send_message(msg);
+    auto fallback = [msg = std::string(msg)](int status) {
+        if (status) {
+            // Fallback: send via tmux
+            send_message(msg);
+        }
+    };
+    if (launcher().spawn({"notify-send", std::string(msg)}, fallback) < 0) {
+        fallback(EXIT_FAILURE);
     };
 }
 
@@ -43,6 +60,9 @@ class WMInstance {
             exit(EXIT_FAILURE);
         }
 
+        // Intern every atom up front, in one round trip
+        atoms(m_xstate.display);
+
         // set error handler: for startup
         XSetErrorHandler(*startup_error_handler);
 
@@ -57,15 +77,34 @@ class WMInstance {
             exit(EXIT_FAILURE);
         }
 
+        advertise_ewmh();
+
         XSetErrorHandler(*runtime_handler);
+
+        // Client messages still work without it
+        if (!m_control.listen()) {
+            std::cerr << "Failed to listen on " << control_socket_path()
+                      << "\n";
+        }
+
+        // Producers fall back to the socket without it
+        if (m_positions.create()) {
+            poller().add(m_positions.fd());
+        } else {
+            std::cerr << "Failed to create " << position_ring_name() << "\n";
+        }
     };
 
     void run() {
 
-        // Open terminal
-        m_xstate.open_term();
+        // Open a terminal on each output
+        update_outputs();
 
-        XEvent ev;
+        // Sources which are never closed, the rest add themselves
+        poller().add(ConnectionNumber(m_xstate.display));
+        poller().add(executor().fd());
+        poller().add(timers().fd());
+        poller().add(launcher().fd());
 
         // set cursor
         XDefineCursor(m_xstate.display, m_xstate.root,
@@ -73,18 +112,47 @@ class WMInstance {
 
         while (!m_stop) {
 
-            // Handle event
-            XNextEvent(m_xstate.display, &ev);
-            handle_event(ev);
-            m_xstate.sync();
+            // Handle events
+            handle_events();
+
+            // Finish work handed back by the executor, reap children, run
+            // expired timers
+            executor().dispatch();
+            launcher().reap();
+            timers().dispatch();
+
+            // Handle tmux notifications
+            for (auto &[name, head] : m_heads) {
+                head.control().dispatch();
+            }
+            handle_tmux_notifications();
+
+            // Handle control socket requests and appended pane positions
+            m_control.dispatch();
+            handle_positions();
+
+            // Handlers may have queued more of either (XPending also flushes)
+            if (XPending(m_xstate.display) || has_tmux_notifications()) {
+                continue;
+            }
+
+            poller().wait();
         }
     };
 
     void stop() {
+        m_control.close();
+        if (m_positions.fd() >= 0) {
+            poller().remove(m_positions.fd());
+        }
+        m_positions.close();
         XCloseDisplay(m_xstate.display);
-        for (auto [tm_window, workspace] : m_tmux_mapping.get_workspaces()) {
-            for (auto [tm_pane, w] : workspace.get_windows()) {
-                kill_pane(tm_pane);
+        for (auto &[name, head] : m_heads) {
+            for (auto [tm_window, workspace] :
+                 head.mapping.get_workspaces()) {
+                for (auto [tm_pane, w] : workspace.get_windows()) {
+                    kill_pane(tm_pane);
+                }
             }
         }
         exit(EXIT_SUCCESS);
@@ -94,26 +162,215 @@ class WMInstance {
     //--- State --------------------------------------------------------------//
 
     XState m_xstate;
-    TmuxXWindowMapping m_tmux_mapping;
 
-    std::queue<Window> m_window_q;
+    // Named by _NET_SUPPORTING_WM_CHECK
+    Window m_wm_check{None};
+
+    // By output name, including disconnected outputs
+    std::map<std::string, Head> m_heads;
+
+    // Head with the input focus, new windows are opened there
+    Head *m_focused{};
+
+    // Pane titles waiting to be sent
+    TitleSync m_titles;
+
+    // Pane geometry, applied at a limited rate
+    ResizeDebouncer m_resizes{[this](Window window, const WindowPosition &pos) {
+        m_xstate.move_resize(window, pos);
+    }};
+
     std::unordered_set<Window> m_pending_windows;
 
+    ControlServer m_control{control_socket_path(),
+                            [this](const ControlRequest &request) {
+                                return handle_request(request);
+                            }};
+
+    PositionRing m_positions;
+
     bool m_stop = false;
     static bool m_existing_wm;
 
     // When sending tmux commands to pane from gui focus
     bool m_ignore_focus = false;
 
+    // Set by tmux notifications, handled once they have all been read
+    bool m_tmux_orphans = false;
+
     //--- Helpers ------------------------------------------------------------//
 
+    // Clients check what is supported before relying on it (e.g. fullscreen,
+    // sync requests). Toolkits like GTK only believe _NET_SUPPORTED once the
+    // root's _NET_SUPPORTING_WM_CHECK names a window which names itself too.
+    void advertise_ewmh() {
+        const Atoms &a = atoms(m_xstate.display);
+
+        // Override redirect, so not managed as a client
+        XSetWindowAttributes attrs{};
+        attrs.override_redirect = True;
+        m_wm_check =
+            XCreateWindow(m_xstate.display, m_xstate.root, -1, -1, 1, 1, 0,
+                          CopyFromParent, InputOnly, CopyFromParent,
+                          CWOverrideRedirect, &attrs);
+        for (Window w : {m_xstate.root, m_wm_check}) {
+            XChangeProperty(m_xstate.display, w,
+                            a[AtomID::NET_SUPPORTING_WM_CHECK], XA_WINDOW, 32,
+                            PropModeReplace,
+                            reinterpret_cast<unsigned char *>(&m_wm_check),
+                            1);
+        }
+        constexpr std::string_view name = "xwmux";
+        XChangeProperty(m_xstate.display, m_wm_check, a[AtomID::NET_WM_NAME],
+                        a[AtomID::UTF8_STRING], 8, PropModeReplace,
+                        reinterpret_cast<const unsigned char *>(name.data()),
+                        name.size());
+
+        std::array<Atom, 12> supported = {
+            a[AtomID::NET_SUPPORTING_WM_CHECK],
+            a[AtomID::NET_WM_NAME],
+            a[AtomID::NET_WM_PID],
+            a[AtomID::NET_WM_STATE],
+            a[AtomID::NET_WM_STATE_HIDDEN],
+            a[AtomID::NET_WM_STATE_FULLSCREEN],
+            a[AtomID::NET_WM_SYNC_REQUEST],
+            a[AtomID::NET_WM_SYNC_REQUEST_COUNTER],
+            a[AtomID::NET_WM_WINDOW_TYPE],
+            a[AtomID::NET_WM_WINDOW_TYPE_DIALOG],
+            a[AtomID::NET_WM_WINDOW_TYPE_UTILITY],
+            a[AtomID::NET_WM_WINDOW_TYPE_SPLASH]};
+        XChangeProperty(m_xstate.display, m_xstate.root,
+                        a[AtomID::NET_SUPPORTED], XA_ATOM, 32,
+                        PropModeReplace,
+                        reinterpret_cast<unsigned char *>(supported.data()),
+                        supported.size());
+    }
+
     void name_client(Window window, TmuxPaneID pane) {
-        XTextProperty name;
-        XGetWMName(m_xstate.display, window, &name);
-        std::string_view name_v(reinterpret_cast<char *>(name.value),
-                                name.nitems);
-        name_pane(pane, name_v);
-        XFree(name.value);
+        const WindowProperties &props = m_xstate.properties.get(window);
+        if (props.title.has_value()) {
+            m_titles.update(pane, props.title.value());
+        }
+    }
+
+    void remove_window(Head &head, Window window) {
+        m_titles.forget(head.mapping.find(window).second);
+        m_resizes.forget(window);
+        head.mapping.remove_window(window);
+    }
+
+    //--- Heads --------------------------------------------------------------//
+
+    // Head managing a window, if any
+    Head *head_of(const Window window) {
+        for (auto &[name, head] : m_heads) {
+            if (head.mapping.has_window(window)) {
+                return &head;
+            }
+        }
+        return nullptr;
+    }
+
+    // Head with a floating overlay, if any
+    Head *head_of_float(const Window window) {
+        for (auto &[name, head] : m_heads) {
+            if (head.floating.has_window(window)) {
+                return &head;
+            }
+        }
+        return nullptr;
+    }
+
+    // Head following a tmux session, if any
+    Head *head_of_session(const std::string_view session) {
+        for (auto &[name, head] : m_heads) {
+            if (head.session == session) {
+                return &head;
+            }
+        }
+        return nullptr;
+    }
+
+    // Head following a tmux session, by ID, if any
+    Head *head_of_session_id(const TmuxSessionID session_id) {
+        for (auto &[name, head] : m_heads) {
+            if (head.session_id == session_id) {
+                return &head;
+            }
+        }
+        return nullptr;
+    }
+
+    // Head whose root terminal this is, if any
+    Head *head_of_term(const Window window) {
+        for (auto &[name, head] : m_heads) {
+            if (head.mapping.term() == window) {
+                return &head;
+            }
+        }
+        return nullptr;
+    }
+
+    // Head a pane was reported for: the one following the session it was
+    // reported from, otherwise the one showing its tmux window, otherwise
+    // the focused head
+    Head &head_of_report(const TmuxPaneReport &report) {
+        if (report.session.has_value()) {
+            for (auto &[name, head] : m_heads) {
+                if (head.session_id == report.session) {
+                    return head;
+                }
+            }
+        }
+        TmuxWindowID tm_window = report.location.first;
+        for (auto &[name, head] : m_heads) {
+            if (head.mapping.get_workspaces().contains(tm_window) ||
+                head.layouts.contains(tm_window)) {
+                return head;
+            }
+        }
+        return *m_focused;
+    }
+
+    // Move the input focus to another head
+    void focus_head(Head &head) {
+        if (m_focused == &head) {
+            return;
+        }
+        if (m_focused) {
+            m_focused->mapping.set_focused(m_xstate, false);
+        }
+        m_focused = &head;
+        focus_session(head.session);
+        head.mapping.set_focused(m_xstate, true);
+        focus_floating(head);
+    }
+
+    void focus_term() { m_xstate.focus(m_focused->mapping.term()); }
+
+    // At most one terminal is launched for a head at a time
+    void open_term(Head &head) {
+        if (head.term_launching || head.mapping.term().has_value()) {
+            return;
+        }
+        head.term_launching =
+            m_xstate.open_term(head.session, [&head](int status) {
+                if (status) {
+                    head.term_launching = false;
+                }
+            });
+    }
+
+    // Create, move or disconnect heads, leaving unchanged outputs alone
+    void update_outputs();
+
+    bool has_tmux_notifications() {
+        for (auto &[name, head] : m_heads) {
+            if (head.control().has_notifications()) {
+                return true;
+            }
+        }
+        return false;
     }
 
     //--- Error handlers -----------------------------------------------------//
@@ -142,7 +399,77 @@ class WMInstance {
 
     void handle_event(XEvent &ev);
 
+    // Handle all queued events, skipping those superseded by a later one,
+    // then flush the requests made
+    void handle_events();
+
     //--- Client message handlers --------------------------------------------//
 
+    // A client asks to enter or leave fullscreen
+    void handle_net_wm_state(const XClientMessageEvent &ev);
+
     template <MsgType msg_type> void handle_client_msg(const Msg &msg);
+
+    // A root terminal has started, and measured itself
+    void init_head(Head &head, const Resolution res_chars,
+                   const Resolution res_px, const TmuxBarPosition bar_pos);
+
+    //--- Control socket handlers --------------------------------------------//
+
+    ControlReply handle_request(const ControlRequest &request);
+
+    //--- tmux notification handlers -----------------------------------------//
+
+    void handle_tmux_notifications();
+    void handle_positions();
+
+    void handle_tmux_notification(Head &head,
+                                  const std::string_view notification);
+
+    // Apply the reported state of a pane: focus, new windows and geometry
+    void update_pane(Head &head, const TmuxPaneReport &report);
+
+    // Apply a new window layout, moving only the panes which changed.
+    // Returns whether panes were added or removed (or it could not be read).
+    bool update_layout(Head &head, const TmuxWindowID tm_window,
+                       const std::string_view layout);
+
+    // Move the X window in a pane (if any) to the pane's last known position
+    void position_pane(Head &head, const TmuxLocation location);
+
+    // Where a pane is on screen, if its position is known
+    std::optional<WindowPosition> pane_area(Head &head,
+                                            const TmuxLocation location);
+
+    //--- Floating overlays --------------------------------------------------//
+
+    // Manage a dialog (or similar) over its parent, without tmux
+    void float_window(const Window window, const WindowProperties &props);
+
+    // Centre an overlay over its parent, or its output
+    void place_float(Head &head, const Window window);
+
+    // Hidden with its owner's pane, or its output
+    bool float_hidden(Head &head, const FloatingWindow &floating);
+
+    // Show and hide overlays to follow their owners, true if any were shown
+    bool update_floating(Head &head);
+
+    // Once the active pane's window has the input focus, pass it on to the
+    // overlay on top of it, if any. Returns the overlay focused.
+    std::optional<Window> focus_floating(Head &head);
+
+    void remove_float(Head &head, const Window window);
+
+    //--- Fullscreen ---------------------------------------------------------//
+
+    // Cover the head's output, outside of tmux, or return to the pane
+    void set_fullscreen(Head &head, const Window window,
+                        const bool fullscreen);
+
+    // Kill the X window in the focused pane, if any
+    void kill_focused();
+
+    // Kill X windows whose panes no longer exist
+    void kill_orphans();
 };
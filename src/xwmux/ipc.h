@@ -1,17 +1,123 @@
 #pragma once
 
+#include "atoms.h"
 #include "layout.h"
 #include "tmux.h"
 #include "xwrapper.h"
 
 extern "C" {
+#include <X11/Xatom.h>
 #include <X11/Xlib.h>
+#include <unistd.h>
 }
 
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
-#define SOCK_PATH "/tmp/xwmux.sock"
+// The X display from the environment, usable in a file name. Screens of a
+// display share its window manager, so are left off.
+inline std::string display_key() {
+    const char *display = std::getenv("DISPLAY");
+    std::string ret = display ? display : "";
+    size_t colon = ret.rfind(':');
+    if (colon != std::string::npos) {
+        ret.erase(std::min(ret.find('.', colon), ret.size()));
+    }
+    std::replace(ret.begin(), ret.end(), '/', '_');
+    return ret;
+}
+
+// Only accessible to the user (see ControlServer::listen)
+inline std::string control_dir() {
+    const char *runtime = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) {
+        return std::string(runtime) + "/xwmux";
+    }
+    return std::format("/tmp/xwmux-{}", getuid());
+}
+
+// One per display, as there is one xwmux per display
+inline std::string control_socket_path() {
+    return control_dir() + "/" + display_key() + ".sock";
+}
+
+// A request over the control socket: the arguments of an
+// xwmux-ctl command, each followed by a NUL, then an empty argument, then any
+// payload, ended by the client shutting down its side of the connection.
+struct ControlRequest {
+    std::vector<std::string> args;
+    std::string payload{};
+
+    std::string encode() const {
+        std::string ret;
+        for (const std::string &arg : args) {
+            ret.append(arg);
+            ret.push_back('\0');
+        }
+        ret.push_back('\0');
+        ret.append(payload);
+        return ret;
+    }
+
+    static std::optional<ControlRequest> decode(std::string_view data) {
+        ControlRequest ret{.args = {}};
+        while (true) {
+            size_t end = data.find('\0');
+            if (end == std::string_view::npos) {
+                return std::nullopt;
+            }
+            std::string_view arg = data.substr(0, end);
+            data.remove_prefix(end + 1);
+            if (arg.empty()) {
+                break;
+            }
+            ret.args.emplace_back(arg);
+        }
+        if (ret.args.empty()) {
+            return std::nullopt;
+        }
+        ret.payload = data;
+        return ret;
+    }
+};
+
+// Errors in a request itself, rather than in carrying it out
+constexpr std::string_view CONTROL_BAD_ARGS = "Bad arguments\n";
+constexpr std::string_view CONTROL_UNKNOWN = "Unknown command\n";
+
+// The reply: "ok" or "error", a newline, then any output, ended by xwmux
+// closing the connection
+struct ControlReply {
+    bool ok;
+    std::string output{};
+
+    // The command was used wrongly, so its usage is worth showing
+    bool usage_error() const {
+        return !ok && (output == CONTROL_BAD_ARGS || output == CONTROL_UNKNOWN);
+    }
+
+    std::string encode() const {
+        return std::string(ok ? "ok" : "error") + '\n' + output;
+    }
+
+    static ControlReply decode(std::string_view data) {
+        size_t end = data.find('\n');
+        if (end == std::string_view::npos) {
+            return {.ok = false};
+        }
+        return {.ok = data.substr(0, end) == "ok",
+                .output = std::string(data.substr(end + 1))};
+    }
+};
 
 enum class MsgType {
     RESOLUTION,
@@ -19,26 +125,33 @@ enum class MsgType {
     EXIT,
     TMUX_POSITION,
     KILL_PANE,
-    KILL_ORPHANS
+    KILL_ORPHANS,
+    TMUX_SNAPSHOT
 };
 
-constexpr Atom msg_type_atom(Display *dpy, const MsgType type) {
-    switch (type) {
-    case MsgType::RESOLUTION:
-        return XInternAtom(dpy, "_XW_RESOUTION", 0);
-    case MsgType::PREFIX:
-        return XInternAtom(dpy, "_XW_PREFIX", 0);
-    case MsgType::EXIT:
-        return XInternAtom(dpy, "_XW_EXIT", 0);
-    case MsgType::TMUX_POSITION:
-        return XInternAtom(dpy, "_XW_TMUX_POSITION", 0);
-    case MsgType::KILL_PANE:
-        return XInternAtom(dpy, "_XW_KILL_PANE", 0);
-    case MsgType::KILL_ORPHANS:
-        return XInternAtom(dpy, "_XW_KILL_ORPHANS", 0);
-    }
-    std::unreachable();
-};
+constexpr std::size_t MSG_TYPE_COUNT =
+    static_cast<std::size_t>(MsgType::TMUX_SNAPSHOT) + 1;
+
+// Message atoms come first in the registry
+constexpr AtomID msg_type_atom_id(const MsgType type) {
+    return static_cast<AtomID>(type);
+}
+static_assert(msg_type_atom_id(MsgType::TMUX_SNAPSHOT) ==
+              AtomID::XW_TMUX_SNAPSHOT);
+
+inline Atom msg_type_atom(Display *dpy, const MsgType type) {
+    return atoms(dpy)[msg_type_atom_id(type)];
+}
+
+// The message type for a ClientMessage's type, if it is ours
+inline std::optional<MsgType> atom_msg_type(Display *dpy, const Atom atom) {
+    std::optional<AtomID> id = atoms(dpy).find(atom);
+    if (!id.has_value() ||
+        static_cast<std::size_t>(id.value()) >= MSG_TYPE_COUNT) {
+        return std::nullopt;
+    }
+    return static_cast<MsgType>(id.value());
+}
 
 struct Msg {
 
@@ -51,10 +164,12 @@ struct Msg {
     constexpr static Msg report_resolution(Display *const dpy,
                                            const Resolution res_chars,
                                            const Resolution res_px,
-                                           TmuxBarPosition const bar_position) {
+                                           TmuxBarPosition const bar_position,
+                                           const Atom session = None) {
         Msg ret(dpy, MsgType::RESOLUTION);
         ret.res_disp_packed() = res_px.pack();
         ret.res_chars_packed() = res_chars.pack();
+        ret.session() = static_cast<long>(session);
         ret.bar_pos() = static_cast<long>(bar_position);
         return ret;
     }
@@ -71,16 +186,32 @@ struct Msg {
                                          const TmuxLocation location,
                                          const WindowPosition position,
                                          const bool focused, const bool zoomed,
-                                         const bool dead) {
+                                         const bool dead,
+                                         const std::optional<TmuxSessionID>
+                                             session = std::nullopt) {
         Msg ret(dpy, MsgType::TMUX_POSITION);
         ret.position_start() = position.start.pack();
         ret.position_end() = position.end.pack();
         ret.tm_window() = location.first;
         ret.tm_pane() = location.second;
-        ret.bitflags() = (focused | (zoomed << 1) | (dead << 2));
+        ret.bitflags() = (focused | (zoomed << 1) | (dead << 2) |
+                          (session.has_value() ? (session.value() + 1L) << 8
+                                               : 0L));
         return ret;
     }
 
+    constexpr static Msg report_position(Display *const dpy,
+                                         const TmuxPaneReport &pane) {
+        return report_position(dpy, pane.location, pane.position,
+                               pane.focused, pane.zoomed, pane.dead,
+                               pane.session);
+    }
+
+    // Panes are read from the root window property (see write_snapshot)
+    constexpr static Msg report_snapshot(Display *const dpy) {
+        return Msg(dpy, MsgType::TMUX_SNAPSHOT);
+    }
+
     constexpr static Msg kill_pane(Display *const dpy,
                                    const TmuxPaneID tm_pane) {
         Msg ret(dpy, MsgType::KILL_PANE);
@@ -108,6 +239,8 @@ struct Msg {
     const long &tm_window() const { return m_ev.xclient.data.l[2]; }
     long &tm_pane() { return m_ev.xclient.data.l[3]; }
     const long &tm_pane() const { return m_ev.xclient.data.l[3]; }
+    // Focused, zoomed and dead from the lowest bit, then from bit 8 the
+    // session ID plus one (0 if not given)
     long &bitflags() { return m_ev.xclient.data.l[4]; }
     const long &zoom_focus() const { return m_ev.xclient.data.l[4]; }
 
@@ -117,6 +250,10 @@ struct Msg {
     long &res_chars_packed() { return m_ev.xclient.data.l[1]; }
     const long &res_chars_packed() const { return m_ev.xclient.data.l[1]; }
 
+    // Atom naming the terminal's session, None if not given
+    long &session() { return m_ev.xclient.data.l[2]; }
+    const long &session() const { return m_ev.xclient.data.l[2]; }
+
     long &bar_pos() { return m_ev.xclient.data.l[4]; }
     const long &bar_pos() const { return m_ev.xclient.data.l[4]; }
 
@@ -132,6 +269,12 @@ struct Msg {
     bool zoomed() const { return zoom_focus() & 0b10; }
     bool dead() const { return zoom_focus() & 0b100; }
 
+    std::optional<TmuxSessionID> tm_session() const {
+        long session = zoom_focus() >> 8 & 0xFFFFFF;
+        return session ? std::optional(static_cast<TmuxSessionID>(session - 1))
+                       : std::nullopt;
+    }
+
     WindowPosition window_position() const {
         return {.start = {Point::unpack(position_start())},
                 .end = {Point::unpack(static_cast<size_t>(position_end()))}};
@@ -139,6 +282,15 @@ struct Msg {
 
     TmuxLocation tm_location() const { return {tm_window(), tm_pane()}; }
 
+    TmuxPaneReport pane_report() const {
+        return {.location = tm_location(),
+                .position = window_position(),
+                .focused = focused(),
+                .zoomed = zoomed(),
+                .dead = dead(),
+                .session = tm_session()};
+    }
+
     Resolution res_chars() const {
         return Resolution(Point::unpack(res_chars_packed()));
     }
@@ -164,3 +316,59 @@ struct Msg {
 
     XEvent m_ev;
 };
+
+// A TMUX_SNAPSHOT carries every pane of a tmux window at once. The panes are
+// appended to a property on the root window, each in the same layout as the
+// data of a TMUX_POSITION message, and announced by a single message.
+
+constexpr size_t SNAPSHOT_RECORD_LEN = 5;
+
+inline void write_snapshot(Display *const dpy,
+                           const std::vector<TmuxPaneReport> &panes) {
+    std::vector<long> data;
+    data.reserve(panes.size() * SNAPSHOT_RECORD_LEN);
+    for (const TmuxPaneReport &pane : panes) {
+        const long *record =
+            Msg::report_position(dpy, pane).get_event().xclient.data.l;
+        data.insert(data.end(), record, record + SNAPSHOT_RECORD_LEN);
+    }
+
+    // Appended, so concurrent snapshots are not lost
+    Atom atom = msg_type_atom(dpy, MsgType::TMUX_SNAPSHOT);
+    XChangeProperty(dpy, XDefaultRootWindow(dpy), atom, XA_INTEGER, 32,
+                    PropModeAppend,
+                    reinterpret_cast<const unsigned char *>(data.data()),
+                    data.size());
+}
+
+// Consumes all snapshots written so far, oldest first
+inline std::vector<TmuxPaneReport> read_snapshot(Display *const dpy) {
+    Atom atom = msg_type_atom(dpy, MsgType::TMUX_SNAPSHOT);
+    Atom type;
+    int format;
+    unsigned long n_items, bytes_after;
+    unsigned char *data = nullptr;
+
+    std::vector<TmuxPaneReport> ret;
+    if (XGetWindowProperty(dpy, XDefaultRootWindow(dpy), atom, 0, LONG_MAX,
+                           True, XA_INTEGER, &type, &format, &n_items,
+                           &bytes_after, &data) != Success) {
+        return ret;
+    }
+
+    if (type == XA_INTEGER && format == 32) {
+        const long *records = reinterpret_cast<const long *>(data);
+        for (size_t i = 0; i + SNAPSHOT_RECORD_LEN <= n_items;
+             i += SNAPSHOT_RECORD_LEN) {
+            XClientMessageEvent ev{};
+            ev.type = ClientMessage;
+            std::memcpy(ev.data.l, records + i,
+                        SNAPSHOT_RECORD_LEN * sizeof(long));
+            ret.push_back(Msg(ev).pane_report());
+        }
+    }
+    if (data) {
+        XFree(data);
+    }
+    return ret;
+}
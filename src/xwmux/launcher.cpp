@@ -0,0 +1,140 @@
+#include "launcher.h"
+
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+extern char **environ;
+
+Launcher::Launcher() : m_epoll_fd(epoll_create1(EPOLL_CLOEXEC)) {}
+
+Launcher::~Launcher() { close(m_epoll_fd); }
+
+pid_t Launcher::spawn(const std::vector<std::string> &argv,
+                      ExitCallback on_exit, const LaunchOptions &options) {
+    std::vector<char *> c_argv;
+    for (const std::string &arg : argv) {
+        c_argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    c_argv.push_back(nullptr);
+
+    // Variables which are set are replaced, so are removed first
+    auto removed = [&options](const char *var) {
+        auto matches = [var](std::string_view name) {
+            return !std::strncmp(var, name.data(), name.size()) &&
+                   var[name.size()] == '=';
+        };
+        return std::any_of(options.unset_env.begin(), options.unset_env.end(),
+                           matches) ||
+               std::any_of(options.set_env.begin(), options.set_env.end(),
+                           [&matches](std::string_view set) {
+                               return matches(set.substr(0, set.find('=')));
+                           });
+    };
+
+    std::vector<char *> c_env;
+    for (char **var = environ; *var; var++) {
+        if (!removed(*var)) {
+            c_env.push_back(*var);
+        }
+    }
+    for (const std::string &var : options.set_env) {
+        c_env.push_back(const_cast<char *>(var.c_str()));
+    }
+    c_env.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (options.stdin_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, options.stdin_fd,
+                                         STDIN_FILENO);
+    }
+    if (options.stdout_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, options.stdout_fd,
+                                         STDOUT_FILENO);
+    }
+
+    // Children start with default signal handling, rather than inheriting
+    // xwmux's (SIGPIPE is ignored, see TmuxControl::connect), which would
+    // carry on to every shell and program run in the terminal
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t defaults, mask;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setflags(&attr,
+                             POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid;
+    int err = posix_spawnp(&pid, c_argv[0], &actions, &attr, c_argv.data(),
+                           c_env.data());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err) {
+        return -1;
+    }
+
+    // Nothing else waits on our children, so the pid can't be reused first
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd < 0) {
+        waitpid(pid, nullptr, 0);
+        return -1;
+    }
+
+    epoll_event ev{.events = EPOLLIN, .data = {.fd = pidfd}};
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, pidfd, &ev);
+
+    std::lock_guard lock(m_mutex);
+    m_children.push_back(
+        {.pid = pid, .pidfd = pidfd, .on_exit = std::move(on_exit)});
+    return pid;
+}
+
+void Launcher::reap() {
+    std::vector<std::pair<ExitCallback, int>> exited;
+    {
+        std::lock_guard lock(m_mutex);
+        std::erase_if(m_children, [this, &exited](Child &child) {
+            siginfo_t info{};
+            int err = waitid(P_PIDFD, child.pidfd, &info, WEXITED | WNOHANG);
+            if (!err && !info.si_pid) {
+                // Still running
+                return false;
+            }
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, child.pidfd, nullptr);
+            close(child.pidfd);
+
+            int status = W_EXITCODE(EXIT_FAILURE, 0);
+            if (!err) {
+                status = info.si_code == CLD_EXITED
+                             ? W_EXITCODE(info.si_status, 0)
+                             : W_EXITCODE(0, info.si_status);
+            }
+            exited.emplace_back(std::move(child.on_exit), status);
+            return true;
+        });
+    }
+
+    // Callbacks may spawn more children
+    for (auto &[on_exit, status] : exited) {
+        if (on_exit) {
+            on_exit(status);
+        }
+    }
+}
+
+Launcher &launcher() {
+    static Launcher instance;
+    return instance;
+}
@@ -0,0 +1,69 @@
+/*
+ * Shell-free process launcher.
+ *
+ * Children are started with posix_spawnp from an argv vector, so no shell or
+ * quoting is involved, and launching returns immediately. Each child is
+ * tracked through a pidfd, all of which are collected in one epoll set for
+ * the main loop to wait on, and reaped from there, calling its exit callback
+ * (if any) on the main thread.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct LaunchOptions {
+    // Replace the child's stdin/stdout, if set
+    int stdin_fd = -1;
+    int stdout_fd = -1;
+
+    // Environment variables removed for the child
+    std::vector<std::string> unset_env = {};
+
+    // Environment variables set for the child, as "NAME=value"
+    std::vector<std::string> set_env = {};
+};
+
+class Launcher {
+  public:
+    // Receives the wait status of the child
+    using ExitCallback = std::function<void(int status)>;
+
+    Launcher();
+    ~Launcher();
+
+    Launcher(const Launcher &other) = delete;
+    Launcher &operator=(const Launcher &other) = delete;
+
+    // Start a program (looked up in PATH), returning its pid, or -1.
+    // Safe to call from any thread.
+    pid_t spawn(const std::vector<std::string> &argv,
+                ExitCallback on_exit = {}, const LaunchOptions &options = {});
+
+    // Reap exited children, on the main thread
+    void reap();
+
+    // Readable once a child has exited
+    int fd() const { return m_epoll_fd; }
+
+  private:
+    struct Child {
+        pid_t pid;
+        int pidfd;
+        ExitCallback on_exit;
+    };
+
+    // Of the children's pidfds
+    int m_epoll_fd;
+
+    std::mutex m_mutex;
+    std::vector<Child> m_children;
+};
+
+// Launcher shared by everything spawning processes
+Launcher &launcher();
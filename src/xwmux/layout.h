@@ -4,8 +4,18 @@ extern "C" {
 #include <X11/Xlib.h>
 }
 
+#include <algorithm>
+#include <charconv>
 #include <cstdint>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
+#include <vector>
+
+using TmuxWindowID = int32_t;
+using TmuxPaneID = int32_t;
+using TmuxSessionID = int32_t;
 
 struct Point {
     std::size_t x;
@@ -21,17 +31,47 @@ struct Point {
         return {.x = (packed_point & 0xFFFF),
                 .y = (packed_point >> 16 & 0xFFFF)};
     }
+
+    constexpr bool operator==(const Point &other) const {
+        return x == other.x && y == other.y;
+    }
 };
 
 struct WindowPosition {
     Point start;
     Point end;
 
+    constexpr bool operator==(const WindowPosition &other) const {
+        return start.x == other.start.x && start.y == other.start.y &&
+               end.x == other.end.x && end.y == other.end.y;
+    }
+
     void resize_to(Display *const display, const Window window) const {
 
         XMoveResizeWindow(display, window, start.x, start.y, end.x - start.x,
                           end.y - start.y);
     }
+
+    // A window of the given size centred over this one, moved (and if need
+    // be, shrunk) to lie within bounds
+    constexpr WindowPosition centre(const Point size,
+                                    const WindowPosition &bounds) const {
+        auto axis = [](const size_t start, const size_t end, size_t size,
+                       const size_t min, const size_t max) {
+            size = std::min(size, max - min);
+            const size_t middle = (start + end) / 2;
+            const size_t origin = middle > size / 2 ? middle - size / 2 : 0;
+            return std::clamp(origin, min, max - size);
+        };
+        const Point origin = {
+            .x = axis(start.x, end.x, size.x, bounds.start.x, bounds.end.x),
+            .y = axis(start.y, end.y, size.y, bounds.start.y, bounds.end.y)};
+        return {.start = origin,
+                .end = {.x = origin.x + std::min(size.x, bounds.end.x -
+                                                             bounds.start.x),
+                        .y = origin.y + std::min(size.y, bounds.end.y -
+                                                             bounds.start.y)}};
+    }
 };
 
 struct Resolution : public Point {
@@ -62,6 +102,35 @@ enum class PaddingDistribution : uint8_t {
     END,
 };
 
+// A client's WM_NORMAL_HINTS, in pixels. Zero means unset, except for
+// increments, which are 1 if unset.
+struct SizeHints {
+    Point min{0, 0};
+    Point max{0, 0};
+    Point base{0, 0};
+    Point increment{1, 1};
+
+    constexpr bool operator==(const SizeHints &other) const {
+        return min.x == other.min.x && min.y == other.min.y &&
+               max.x == other.max.x && max.y == other.max.y &&
+               base.x == other.base.x && base.y == other.base.y &&
+               increment.x == other.increment.x &&
+               increment.y == other.increment.y;
+    }
+
+    // Largest conforming size up to the available size on one axis, or the
+    // available size if none fits
+    static constexpr size_t fit(const size_t available, const size_t min_size,
+                                const size_t max_size, const size_t base_size,
+                                const size_t increment) {
+        size_t size = max_size ? std::min(available, max_size) : available;
+        if (size > base_size && increment > 1) {
+            size -= (size - base_size) % increment;
+        }
+        return size < min_size ? available : size;
+    }
+};
+
 struct WindowLayouts {
 
     // Assumes padding is minimal given screen/terminal resolution
@@ -120,11 +189,41 @@ struct WindowLayouts {
         update_char_resolution(char_grid_resolution);
     }
 
+    // The terminal's grid has changed, e.g. after being resized or zoomed.
+    // Cells keep their size unless given (in pixels). Returns whether
+    // anything changed.
+    bool resize_term(const Resolution term_resolution, const Resolution cell) {
+        const Resolution cell_px =
+            cell.x && cell.y ? cell : m_term_char_resolution;
+        if (term_resolution == m_term_resolution &&
+            cell_px == m_term_char_resolution) {
+            return false;
+        }
+        set_term_resolution(term_resolution,
+                            {term_resolution.x * cell_px.x,
+                             term_resolution.y * cell_px.y});
+        return true;
+    }
+
     void set_screen_resolution(const Resolution resoltuion) {
         m_screen_resolution = resoltuion;
         update_char_resolution();
     }
 
+    // The terminal covers an output, rather than the whole screen
+    void set_screen_area(const WindowPosition area) {
+        m_screen_origin = area.start;
+        m_screen_resolution = {area.end.x - area.start.x,
+                               area.end.y - area.start.y};
+
+        // The grid keeps its size until the terminal reports its new one
+        update_char_resolution(
+            {std::min(m_term_resolution.x * m_term_char_resolution.x,
+                      m_screen_resolution.x),
+             std::min(m_term_resolution.y * m_term_char_resolution.y,
+                      m_screen_resolution.y)});
+    }
+
     void set_bar_position(const TmuxBarPosition bar_position) {
         m_bar_position = bar_position;
     }
@@ -144,6 +243,26 @@ struct WindowLayouts {
                 .end = term_to_screen_pos(position.end)};
     }
 
+    // Largest size within a pane accepted by the client, with the remaining
+    // space distributed as the terminal's padding is
+    constexpr WindowPosition fit(const WindowPosition pane,
+                                 const SizeHints &hints) const {
+        const size_t width = pane.end.x - pane.start.x;
+        const size_t height = pane.end.y - pane.start.y;
+        const Point size = {
+            .x = hints.fit(width, hints.min.x, hints.max.x, hints.base.x,
+                           hints.increment.x),
+            .y = hints.fit(height, hints.min.y, hints.max.y, hints.base.y,
+                           hints.increment.y)};
+        const Point start = {
+            .x = pane.start.x +
+                 init_padding(width - size.x, m_x_padding_distribution),
+            .y = pane.start.y +
+                 init_padding(height - size.y, m_y_padding_distribution)};
+        return {.start = start,
+                .end = {.x = start.x + size.x, .y = start.y + size.y}};
+    }
+
   private:
     constexpr Resolution
     char_resolution(const Resolution screen_resolution,
@@ -213,12 +332,16 @@ struct WindowLayouts {
     // Top left pixel of terminal character
     // Ignores bar
     constexpr Point term_to_screen_pos(const Point pixel_idx) const {
-        return {.x = term_to_screen_pos(
-                    pixel_idx.x, m_screen_resolution.x, m_term_resolution.x,
-                    m_term_char_resolution.x, m_init_padding.x),
-                .y = term_to_screen_pos(
-                    pixel_idx.y, m_screen_resolution.y, m_term_resolution.y,
-                    m_term_char_resolution.y, m_init_padding.y)};
+        return {.x = m_screen_origin.x +
+                     term_to_screen_pos(pixel_idx.x, m_screen_resolution.x,
+                                        m_term_resolution.x,
+                                        m_term_char_resolution.x,
+                                        m_init_padding.x),
+                .y = m_screen_origin.y +
+                     term_to_screen_pos(pixel_idx.y, m_screen_resolution.y,
+                                        m_term_resolution.y,
+                                        m_term_char_resolution.y,
+                                        m_init_padding.y)};
     }
 
     // Helper: one axis
@@ -238,6 +361,9 @@ struct WindowLayouts {
     Resolution m_screen_resolution;
     Resolution m_term_resolution;
 
+    // Top left of the terminal's output
+    Point m_screen_origin{0, 0};
+
     TmuxBarPosition m_bar_position;
     PaddingDistribution m_x_padding_distribution;
     PaddingDistribution m_y_padding_distribution;
@@ -247,3 +373,237 @@ struct WindowLayouts {
 
     Resolution m_init_padding;
 };
+
+// A cell of a tmux window layout, as output by #{window_layout}, e.g.
+// "c195,80x24,0,0[80x12,0,0,0,80x11,0,13,1]".
+// Positions are in characters. Leaves hold a pane, other cells are split
+// left-right ({...}) or top-bottom ([...]) into their children.
+struct TmuxLayoutCell {
+    WindowPosition position;
+    std::optional<TmuxPaneID> pane;
+    std::vector<TmuxLayoutCell> children;
+
+    // Parse a complete layout, including (and verifying) its checksum
+    static std::optional<TmuxLayoutCell> parse(std::string_view layout) {
+        size_t comma = layout.find(',');
+        if (comma == std::string_view::npos) {
+            return std::nullopt;
+        }
+
+        uint16_t csum;
+        std::string_view csum_str = layout.substr(0, comma);
+        auto [ptr, ec] = std::from_chars(
+            csum_str.data(), csum_str.data() + csum_str.size(), csum, 16);
+        if (ec != std::errc() || ptr != csum_str.data() + csum_str.size()) {
+            return std::nullopt;
+        }
+
+        layout.remove_prefix(comma + 1);
+        if (checksum(layout) != csum) {
+            return std::nullopt;
+        }
+
+        std::optional<TmuxLayoutCell> ret = parse_cell(layout);
+        if (!layout.empty()) {
+            return std::nullopt;
+        }
+        return ret;
+    }
+
+    // Positions of all panes in the layout
+    void collect_panes(
+        std::unordered_map<TmuxPaneID, WindowPosition> &panes) const {
+        if (pane.has_value()) {
+            panes[pane.value()] = position;
+        }
+        for (const TmuxLayoutCell &child : children) {
+            child.collect_panes(panes);
+        }
+    }
+
+  private:
+    // As in tmux's layout-custom.c
+    static constexpr uint16_t checksum(const std::string_view layout) {
+        uint16_t csum = 0;
+        for (char c : layout) {
+            csum = (csum >> 1) + ((csum & 1) << 15);
+            csum += c;
+        }
+        return csum;
+    }
+
+    // Consume a number, then the separator following it, if given
+    static std::optional<size_t> parse_number(std::string_view &layout,
+                                              const char separator = '\0') {
+        size_t ret;
+        auto [ptr, ec] =
+            std::from_chars(layout.data(), layout.data() + layout.size(), ret);
+        if (ec != std::errc()) {
+            return std::nullopt;
+        }
+        layout.remove_prefix(ptr - layout.data());
+        if (separator) {
+            if (!layout.starts_with(separator)) {
+                return std::nullopt;
+            }
+            layout.remove_prefix(1);
+        }
+        return ret;
+    }
+
+    // Consume a single cell: "WxH,X,Y" followed by ",ID" or children
+    static std::optional<TmuxLayoutCell> parse_cell(std::string_view &layout) {
+        std::optional<size_t> w = parse_number(layout, 'x');
+        std::optional<size_t> h = parse_number(layout, ',');
+        std::optional<size_t> x = parse_number(layout, ',');
+        std::optional<size_t> y = parse_number(layout);
+        if (!w || !h || !x || !y) {
+            return std::nullopt;
+        }
+
+        TmuxLayoutCell ret{
+            .position = {.start = {x.value(), y.value()},
+                         .end = {x.value() + w.value(),
+                                 y.value() + h.value()}},
+            .pane = std::nullopt,
+            .children = {},
+        };
+
+        if (layout.starts_with(',')) {
+            layout.remove_prefix(1);
+            std::optional<size_t> pane = parse_number(layout);
+            if (!pane) {
+                return std::nullopt;
+            }
+            ret.pane = static_cast<TmuxPaneID>(pane.value());
+            return ret;
+        }
+
+        char close;
+        if (layout.starts_with('{')) {
+            close = '}';
+        } else if (layout.starts_with('[')) {
+            close = ']';
+        } else {
+            return std::nullopt;
+        }
+        layout.remove_prefix(1);
+
+        do {
+            std::optional<TmuxLayoutCell> child = parse_cell(layout);
+            if (!child) {
+                return std::nullopt;
+            }
+            ret.children.push_back(std::move(child.value()));
+        } while (layout.starts_with(',') && (layout.remove_prefix(1), true));
+
+        if (!layout.starts_with(close)) {
+            return std::nullopt;
+        }
+        layout.remove_prefix(1);
+        return ret;
+    }
+};
+
+// The last known layout of each tmux window, used to find the panes whose
+// position actually changed when a new layout arrives.
+struct TmuxLayouts {
+
+    // Store a new layout for the window, returning the panes which moved
+    std::vector<TmuxPaneID> update(const TmuxWindowID tm_window,
+                                   TmuxLayoutCell layout) {
+        std::unordered_map<TmuxPaneID, WindowPosition> panes;
+        layout.collect_panes(panes);
+        m_layouts[tm_window] = std::move(layout);
+
+        std::vector<TmuxPaneID> ret;
+        std::unordered_map<TmuxPaneID, WindowPosition> &old =
+            m_panes[tm_window];
+        for (const auto &[tm_pane, position] : panes) {
+            auto it = old.find(tm_pane);
+            if (it == old.end() || !(it->second == position)) {
+                ret.push_back(tm_pane);
+            }
+        }
+        old = std::move(panes);
+        return ret;
+    }
+
+    // Whether a layout has the same panes as the window's stored one, so only
+    // their geometry may differ
+    bool same_panes(const TmuxWindowID tm_window,
+                    const TmuxLayoutCell &layout) const {
+        auto it = m_panes.find(tm_window);
+        if (it == m_panes.end()) {
+            return false;
+        }
+        std::unordered_map<TmuxPaneID, WindowPosition> panes;
+        layout.collect_panes(panes);
+        if (panes.size() != it->second.size()) {
+            return false;
+        }
+        for (const auto &[tm_pane, position] : panes) {
+            if (!it->second.contains(tm_pane)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Store the position of a single pane, returning whether it moved
+    bool update(const TmuxWindowID tm_window, const TmuxPaneID tm_pane,
+                const WindowPosition position) {
+        auto [it, inserted] = m_panes[tm_window].try_emplace(tm_pane, position);
+        if (inserted) {
+            return true;
+        }
+        bool ret = !(it->second == position);
+        it->second = position;
+        return ret;
+    }
+
+    std::optional<WindowPosition> find(const TmuxWindowID tm_window,
+                                       const TmuxPaneID tm_pane) const {
+        auto window = m_panes.find(tm_window);
+        if (window == m_panes.end()) {
+            return std::nullopt;
+        }
+        auto pane = window->second.find(tm_pane);
+        if (pane == window->second.end()) {
+            return std::nullopt;
+        }
+        return pane->second;
+    }
+
+    bool contains(const TmuxWindowID tm_window) const {
+        return m_panes.contains(tm_window);
+    }
+
+    // Size of the window in characters, as of its last layout
+    std::optional<Point> size(const TmuxWindowID tm_window) const {
+        auto it = m_layouts.find(tm_window);
+        if (it == m_layouts.end()) {
+            return std::nullopt;
+        }
+        const WindowPosition &position = it->second.position;
+        return Point{.x = position.end.x - position.start.x,
+                     .y = position.end.y - position.start.y};
+    }
+
+    void erase(const TmuxWindowID tm_window) {
+        m_layouts.erase(tm_window);
+        m_panes.erase(tm_window);
+    }
+
+    // Forget everything, e.g. when the mapping to the screen changes
+    void clear() {
+        m_layouts.clear();
+        m_panes.clear();
+    }
+
+  private:
+    std::unordered_map<TmuxWindowID, TmuxLayoutCell> m_layouts;
+    std::unordered_map<TmuxWindowID,
+                       std::unordered_map<TmuxPaneID, WindowPosition>>
+        m_panes;
+};
@@ -1,9 +1,61 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <format>
 #include <iostream>
+#include <string>
 #include <string_view>
 
+#include "launcher.h"
+
 constexpr void log_msg(const std::string_view msg) {
     std::cerr << "[XWMUX]: " << msg;
-    std::system(std::format("notify-send '{}'", msg).c_str());
+    launcher().spawn({"notify-send", std::string(msg)});
 }
+
+// Set (to anything but 0) to report latencies on stderr
+const std::string LATENCY_LOG_VAR = "XWMUX_LOG_LATENCY";
+
+// Running statistics for a latency. With LATENCY_LOG_VAR set, each sample is
+// reported to stderr, and a summary on exit. Not through log_msg, which
+// notifies the user too.
+struct LatencyStats {
+    LatencyStats(std::string name)
+        : m_name(std::move(name)), m_enabled(enabled_from_env()) {}
+
+    ~LatencyStats() {
+        if (m_enabled && m_count) {
+            std::cerr << std::format(
+                "[XWMUX]: {} latency: mean {:.2f} ms, max {:.2f} ms, n = {}\n",
+                m_name, m_total / m_count, m_max, m_count);
+        }
+    }
+
+    void record(const std::chrono::steady_clock::duration latency) {
+        if (!m_enabled) {
+            return;
+        }
+        double ms = std::chrono::duration<double, std::milli>(latency).count();
+        m_count++;
+        m_total += ms;
+        m_max = std::max(m_max, ms);
+        std::cerr << std::format("[XWMUX]: {} latency: {:.2f} ms (mean {:.2f} "
+                                 "ms, max {:.2f} ms, n = {})\n",
+                                 m_name, ms, m_total / m_count, m_max,
+                                 m_count);
+    }
+
+  private:
+    static bool enabled_from_env() {
+        const char *value = std::getenv(LATENCY_LOG_VAR.c_str());
+        return value && *value && std::string_view(value) != "0";
+    }
+
+    std::string m_name;
+    bool m_enabled;
+    size_t m_count{};
+    double m_total{};
+    double m_max{};
+};
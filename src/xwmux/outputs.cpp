@@ -0,0 +1,105 @@
+#include "outputs.h"
+
+#ifdef XWMUX_RANDR
+extern "C" {
+#include <X11/extensions/Xrandr.h>
+}
+
+#include <algorithm>
+#endif
+
+// Name of the screen, without RandR
+static const std::string SCREEN_OUTPUT = "screen";
+
+Outputs::Outputs(Display *const display) : m_display(display) {
+#ifdef XWMUX_RANDR
+    int error_base;
+    if (display && XRRQueryExtension(display, &m_event_base, &error_base)) {
+        XRRSelectInput(display, XDefaultRootWindow(display),
+                       RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask |
+                           RROutputChangeNotifyMask);
+    } else {
+        m_event_base = -1;
+    }
+#endif
+}
+
+std::vector<Output> Outputs::query(const Resolution screen) const {
+    std::vector<Output> ret;
+
+#ifdef XWMUX_RANDR
+    const Window root = XDefaultRootWindow(m_display);
+    XRRScreenResources *resources =
+        m_event_base >= 0 ? XRRGetScreenResourcesCurrent(m_display, root)
+                          : nullptr;
+    if (resources) {
+        const RROutput primary = XRRGetOutputPrimary(m_display, root);
+        std::vector<RRCrtc> crtcs;
+        for (int i = 0; i < resources->noutput; i++) {
+            XRROutputInfo *info =
+                XRRGetOutputInfo(m_display, resources, resources->outputs[i]);
+            if (!info) {
+                continue;
+            }
+
+            // Clones share a CRTC, and would share an area
+            if (info->connection == RR_Connected && info->crtc &&
+                std::find(crtcs.begin(), crtcs.end(), info->crtc) ==
+                    crtcs.end()) {
+                XRRCrtcInfo *crtc =
+                    XRRGetCrtcInfo(m_display, resources, info->crtc);
+                if (crtc && crtc->width && crtc->height) {
+                    crtcs.push_back(info->crtc);
+                    const Point start = {.x = static_cast<size_t>(crtc->x),
+                                         .y = static_cast<size_t>(crtc->y)};
+                    ret.push_back({
+                        .name = std::string(info->name, info->nameLen),
+                        .area = {.start = start,
+                                 .end = {.x = start.x + crtc->width,
+                                         .y = start.y + crtc->height}},
+                        .primary = resources->outputs[i] == primary,
+                    });
+                }
+                if (crtc) {
+                    XRRFreeCrtcInfo(crtc);
+                }
+            }
+            XRRFreeOutputInfo(info);
+        }
+        XRRFreeScreenResources(resources);
+    }
+
+    // Without a primary output, the first is used as one
+    std::stable_partition(ret.begin(), ret.end(),
+                          [](const Output &output) { return output.primary; });
+    if (!ret.empty()) {
+        ret.front().primary = true;
+    }
+#endif
+
+    if (ret.empty()) {
+        ret.push_back({.name = SCREEN_OUTPUT,
+                       .area = screen.fullscreen(),
+                       .primary = true});
+    }
+    return ret;
+}
+
+bool Outputs::is_event(const XEvent &ev) const {
+#ifdef XWMUX_RANDR
+    return m_event_base >= 0 &&
+           (ev.type == m_event_base + RRScreenChangeNotify ||
+            ev.type == m_event_base + RRNotify);
+#else
+    (void)ev;
+    return false;
+#endif
+}
+
+void Outputs::update_configuration(XEvent &ev) const {
+#ifdef XWMUX_RANDR
+    XRRUpdateConfiguration(&ev);
+#else
+    (void)ev;
+#endif
+}
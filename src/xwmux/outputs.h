@@ -0,0 +1,48 @@
+/*
+ * Outputs (monitors) of the screen, as reported by RandR.
+ *
+ * Each connected output driven by a CRTC covers an area of the root window.
+ * Without RandR, at build or run time, the whole screen is a single output.
+ */
+
+#pragma once
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+
+#include <string>
+#include <vector>
+
+#include "layout.h"
+
+struct Output {
+    std::string name;
+
+    // In root window coordinates
+    WindowPosition area;
+
+    bool primary;
+
+    bool operator==(const Output &other) const = default;
+};
+
+class Outputs {
+  public:
+    // Selects RandR events on the root window, if available
+    Outputs(Display *const display);
+
+    // Connected outputs, primary first. Clones are reported once. Without
+    // RandR, the screen (of the given size) is the only output.
+    std::vector<Output> query(const Resolution screen) const;
+
+    // True for RandR events, which are all handled by querying again
+    bool is_event(const XEvent &ev) const;
+
+    // Update Xlib's idea of the screen size after a RandR event
+    void update_configuration(XEvent &ev) const;
+
+  private:
+    Display *m_display;
+    int m_event_base{-1};
+};
@@ -0,0 +1,37 @@
+#include "poller.h"
+
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+
+Poller::Poller() : m_epoll_fd(epoll_create1(EPOLL_CLOEXEC)) {}
+
+Poller::~Poller() { close(m_epoll_fd); }
+
+void Poller::add(const int fd, const uint32_t events) {
+    epoll_event ev{.events = events, .data = {.fd = fd}};
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void Poller::modify(const int fd, const uint32_t events) {
+    epoll_event ev{.events = events, .data = {.fd = fd}};
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void Poller::remove(const int fd) {
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void Poller::wait() {
+    // Only whether anything is ready matters
+    std::array<epoll_event, 16> events;
+    while (epoll_wait(m_epoll_fd, events.data(), events.size(), -1) < 0 &&
+           errno == EINTR) {
+    }
+}
+
+Poller &poller() {
+    static Poller instance;
+    return instance;
+}
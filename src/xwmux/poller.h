@@ -0,0 +1,38 @@
+/*
+ * The set of file descriptors the main loop waits on, as a single epoll
+ * instance.
+ *
+ * Each descriptor is added by its owner when opened, and removed before it
+ * is closed, so nothing is registered again on every wait. Waking up says
+ * nothing about which descriptor was ready: the main loop gives every source
+ * a chance to run, and each only does work when it has some.
+ */
+
+#pragma once
+
+#include <sys/epoll.h>
+
+#include <cstdint>
+
+class Poller {
+  public:
+    Poller();
+    ~Poller();
+
+    Poller(const Poller &other) = delete;
+    Poller &operator=(const Poller &other) = delete;
+
+    // Safe to call from any thread
+    void add(const int fd, const uint32_t events = EPOLLIN);
+    void modify(const int fd, const uint32_t events);
+    void remove(const int fd);
+
+    // Block until a descriptor is ready
+    void wait();
+
+  private:
+    int m_epoll_fd;
+};
+
+// Descriptors of the main loop
+Poller &poller();
@@ -0,0 +1,155 @@
+#include "position_ring.h"
+
+#include <sys/eventfd.h>
+
+#include <cerrno>
+#include <new>
+
+bool PositionRing::create() {
+    std::string name = position_ring_name();
+
+    // Another xwmux on this display is still reading it
+    if (PositionRingProducer().connected()) {
+        return false;
+    }
+
+    // Only our own user may append
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                      S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        return false;
+    }
+    void *addr = MAP_FAILED;
+    if (!ftruncate(fd, sizeof(PositionRingShared))) {
+        addr = mmap(nullptr, sizeof(PositionRingShared),
+                    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    m_ring = new (addr) PositionRingShared{};
+    for (uint64_t i = 0; i < POSITION_RING_LEN; i++) {
+        m_ring->slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    m_ring->pid = getpid();
+
+    // Producers check this last
+    std::atomic_thread_fence(std::memory_order_release);
+    m_ring->magic = POSITION_RING_MAGIC;
+
+    m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_event_fd < 0) {
+        close();
+        return false;
+    }
+    m_stop = false;
+    m_thread = std::thread(&PositionRing::watch, this);
+    return true;
+}
+
+void PositionRing::close() {
+    if (m_stall_timer.has_value()) {
+        timers().cancel(m_stall_timer.value());
+        m_stall_timer.reset();
+    }
+    m_stalled.reset();
+    if (m_thread.joinable()) {
+        m_stop = true;
+        m_ring->wake.fetch_add(1);
+        futex(m_ring->wake, FUTEX_WAKE, 1);
+        m_thread.join();
+    }
+    if (m_event_fd >= 0) {
+        ::close(m_event_fd);
+        m_event_fd = -1;
+    }
+    if (m_ring) {
+        m_ring->magic = 0;
+        munmap(m_ring, sizeof(PositionRingShared));
+        m_ring = nullptr;
+        shm_unlink(position_ring_name().c_str());
+    }
+}
+
+void PositionRing::watch() {
+    uint32_t seen = m_ring->wake.load();
+    while (!m_stop) {
+        // Producers only wake the futex once this is set, so check again
+        // after setting it, before sleeping
+        m_ring->waiting.store(1);
+        while (m_ring->wake.load() == seen && !m_stop) {
+            if (futex(m_ring->wake, FUTEX_WAIT, seen) < 0 && errno != EAGAIN &&
+                errno != EINTR) {
+                break;
+            }
+        }
+        m_ring->waiting.store(0);
+        seen = m_ring->wake.load();
+
+        // Appends since the last wake are coalesced by the eventfd counter
+        uint64_t one = 1;
+        (void)!write(m_event_fd, &one, sizeof(one));
+    }
+}
+
+std::vector<TmuxPaneReport> PositionRing::drain() {
+    std::vector<TmuxPaneReport> ret;
+    if (!m_ring) {
+        return ret;
+    }
+    uint64_t count;
+    (void)!read(m_event_fd, &count, sizeof(count));
+
+    // Stop at the first slot still being written, the append which finishes
+    // it wakes us again
+    uint64_t head = m_ring->head.load(std::memory_order_relaxed);
+    while (true) {
+        PositionSlot &slot = m_ring->slots[head % POSITION_RING_LEN];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq == head + 1) {
+            ret.push_back(slot.record.report());
+        } else if (!abandoned(head, seq)) {
+            break;
+        }
+
+        // Free for the next lap
+        slot.seq.store(head + POSITION_RING_LEN, std::memory_order_release);
+        head++;
+    }
+    m_ring->head.store(head, std::memory_order_relaxed);
+    return ret;
+}
+
+bool PositionRing::abandoned(const uint64_t head, const uint64_t seq) {
+    // Nothing claimed. A producer skipped as dead, but only slow, may have
+    // published into the slot since, which is then made free again.
+    if (m_ring->tail.load() == head) {
+        if (seq != head) {
+            m_ring->slots[head % POSITION_RING_LEN].seq.store(head);
+        }
+        m_stalled.reset();
+        return false;
+    }
+
+    Timers::Clock::time_point now = Timers::Clock::now();
+    if (m_stalled != head) {
+        m_stalled = head;
+        m_stalled_since = now;
+
+        // Nothing else may wake us
+        if (m_stall_timer.has_value()) {
+            timers().cancel(m_stall_timer.value());
+        }
+        m_stall_timer = timers().add(now + POSITION_ABANDON_TIMEOUT, [this] {
+            m_stall_timer.reset();
+            uint64_t one = 1;
+            (void)!write(m_event_fd, &one, sizeof(one));
+        });
+        return false;
+    }
+    return now - m_stalled_since >= POSITION_ABANDON_TIMEOUT;
+}
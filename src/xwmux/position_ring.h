@@ -0,0 +1,245 @@
+/*
+ * Shared memory ring of pane positions, for producers which send many
+ * updates (hooks, helpers, stress tests).
+ *
+ * xwmux creates the ring, as a POSIX shared memory object, and is its only
+ * consumer. Any number of processes may append fixed-size records to it with
+ * nothing more than an atomic claim of a slot, then a futex wake if xwmux is
+ * waiting. A thread in xwmux waits on the futex and wakes the main loop
+ * through an eventfd, which then drains the ring in one batch.
+ *
+ * Slots carry a sequence number (as in Vyukov's bounded queue), so a slot is
+ * only read once its producer has finished writing it, and only reused once
+ * it has been read. A producer which dies between claiming a slot and
+ * publishing it would stop the ring there, so such a slot is skipped after
+ * POSITION_ABANDON_TIMEOUT.
+ */
+
+#pragma once
+
+extern "C" {
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+}
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipc.h"
+#include "layout.h"
+#include "timers.h"
+#include "tmux.h"
+
+// Per user and display, as the control socket is
+inline std::string position_ring_name() {
+    return std::format("/xwmux-{}-{}-positions", getuid(), display_key());
+}
+
+constexpr uint32_t POSITION_RING_MAGIC = 0x78776d31;
+
+// Slots, a power of two
+constexpr std::size_t POSITION_RING_LEN = 4096;
+
+// A slot claimed for this long without being published is taken to belong to
+// a producer which has died, and skipped. Writing a record takes nanoseconds.
+constexpr std::chrono::milliseconds POSITION_ABANDON_TIMEOUT(500);
+
+// A pane's state, laid out as the data of a TMUX_POSITION message
+struct PositionRecord {
+    int32_t tm_window;
+    int32_t tm_pane;
+    Point::PackedPoint start;
+    Point::PackedPoint end;
+    // Focused, zoomed and dead, from the lowest bit
+    uint32_t flags;
+    // -1 if not given
+    int32_t session;
+
+    static PositionRecord from_report(const TmuxPaneReport &report) {
+        return {.tm_window = report.location.first,
+                .tm_pane = report.location.second,
+                .start = report.position.start.pack(),
+                .end = report.position.end.pack(),
+                .flags = static_cast<uint32_t>(report.focused |
+                                               (report.zoomed << 1) |
+                                               (report.dead << 2)),
+                .session = report.session.value_or(-1)};
+    }
+
+    TmuxPaneReport report() const {
+        return {.location = {tm_window, tm_pane},
+                .position = {.start = Point::unpack(start),
+                             .end = Point::unpack(end)},
+                .focused = static_cast<bool>(flags & 0b1),
+                .zoomed = static_cast<bool>(flags & 0b10),
+                .dead = static_cast<bool>(flags & 0b100),
+                .session = session >= 0 ? std::optional(session)
+                                        : std::nullopt};
+    }
+};
+
+struct PositionSlot {
+    // pos + 1 once written for position pos, pos + POSITION_RING_LEN once
+    // read and free for the next lap
+    std::atomic<uint64_t> seq;
+    PositionRecord record;
+};
+
+// Atomics are shared between processes, so must not hide a lock
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+struct PositionRingShared {
+    uint32_t magic;
+    // Of the consumer, for producers to check it is still running
+    pid_t pid;
+
+    // Next position to claim
+    alignas(64) std::atomic<uint64_t> tail;
+
+    // Next position to read, only moved by the consumer
+    alignas(64) std::atomic<uint64_t> head;
+
+    // Futex word, changed by every append, and set while the consumer waits
+    // on it
+    alignas(64) std::atomic<uint32_t> wake;
+    std::atomic<uint32_t> waiting;
+
+    PositionSlot slots[POSITION_RING_LEN];
+};
+
+inline long futex(std::atomic<uint32_t> &word, const int op,
+                  const uint32_t value) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), op, value,
+                   nullptr, nullptr, 0);
+}
+
+// Appends to the ring of a running xwmux
+class PositionRingProducer {
+  public:
+    PositionRingProducer() {
+        int fd = shm_open(position_ring_name().c_str(), O_RDWR | O_CLOEXEC, 0);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (!fstat(fd, &st) &&
+            static_cast<std::size_t>(st.st_size) == sizeof(PositionRingShared)) {
+            void *addr = mmap(nullptr, sizeof(PositionRingShared),
+                              PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED) {
+                m_ring = static_cast<PositionRingShared *>(addr);
+            }
+        }
+        close(fd);
+
+        // Left behind by an xwmux which did not exit cleanly
+        if (m_ring && (m_ring->magic != POSITION_RING_MAGIC ||
+                       kill(m_ring->pid, 0))) {
+            munmap(m_ring, sizeof(PositionRingShared));
+            m_ring = nullptr;
+        }
+    }
+
+    ~PositionRingProducer() {
+        if (m_ring) {
+            munmap(m_ring, sizeof(PositionRingShared));
+        }
+    }
+
+    PositionRingProducer(const PositionRingProducer &other) = delete;
+    PositionRingProducer &operator=(const PositionRingProducer &other) = delete;
+
+    bool connected() const { return m_ring; }
+
+    // False if not connected, or the ring is full
+    bool push(const PositionRecord &record) {
+        if (!m_ring) {
+            return false;
+        }
+
+        // Claim the slot at the tail, if it has been read
+        uint64_t pos = m_ring->tail.load(std::memory_order_relaxed);
+        PositionSlot *slot;
+        while (true) {
+            slot = &m_ring->slots[pos % POSITION_RING_LEN];
+            uint64_t seq = slot->seq.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(seq - pos);
+            if (diff == 0) {
+                if (m_ring->tail.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_ring->tail.load(std::memory_order_relaxed);
+            }
+        }
+        slot->record = record;
+        slot->seq.store(pos + 1, std::memory_order_release);
+
+        // Only a syscall while the consumer sleeps
+        m_ring->wake.fetch_add(1);
+        if (m_ring->waiting.load()) {
+            futex(m_ring->wake, FUTEX_WAKE, 1);
+        }
+        return true;
+    }
+
+  private:
+    PositionRingShared *m_ring{};
+};
+
+// The consumer, in xwmux
+class PositionRing {
+  public:
+    PositionRing() = default;
+    ~PositionRing() { close(); }
+
+    PositionRing(const PositionRing &other) = delete;
+    PositionRing &operator=(const PositionRing &other) = delete;
+
+    // Replaces a ring left behind, but not one another xwmux still reads.
+    // Returns false if it could not be created.
+    bool create();
+
+    // Stop waking the main loop, and remove the ring
+    void close();
+
+    // Records appended since the last drain, oldest first
+    std::vector<TmuxPaneReport> drain();
+
+    // Readable once records have been appended, -1 if not created
+    int fd() const { return m_event_fd; }
+
+  private:
+    // Wait for appends on the futex, and pass them on to the eventfd
+    void watch();
+
+    // Whether the unpublished slot at the head is to be skipped. Tracks how
+    // long it has been waited on, and drains again once it times out.
+    bool abandoned(const uint64_t head, const uint64_t seq);
+
+    PositionRingShared *m_ring{};
+    int m_event_fd{-1};
+
+    // Unpublished slot waited on, since when
+    std::optional<uint64_t> m_stalled{};
+    Timers::Clock::time_point m_stalled_since{};
+    std::optional<Timers::TimerID> m_stall_timer{};
+    std::atomic<bool> m_stop{false};
+    std::thread m_thread;
+};
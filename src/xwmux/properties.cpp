@@ -0,0 +1,474 @@
+#include "properties.h"
+
+extern "C" {
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+}
+
+#include <algorithm>
+
+#include "atoms.h"
+
+void PropertyCache::prefetch(const Window id) {
+    auto [it, inserted] = m_windows.try_emplace(id);
+    Entry &entry = it->second;
+
+    // Selected before reading, so no change can be missed in between
+    if (inserted) {
+        const uint32_t mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+        xcb_change_window_attributes(m_connection, id, XCB_CW_EVENT_MASK,
+                                     &mask);
+    }
+
+    // Fields already requested are requested again once read
+    const uint32_t fields = entry.stale & ~entry.pending;
+    if (!fields) {
+        return;
+    }
+    entry.stale &= ~fields;
+    entry.pending |= fields;
+
+    Cookies &cookies = entry.cookies;
+    if (fields & ATTRIBUTES) {
+        cookies.attributes = xcb_get_window_attributes(m_connection, id);
+    }
+    if (fields & CLASS) {
+        cookies.wm_class = request(id, XCB_ATOM_WM_CLASS, XCB_ATOM_STRING,
+                                   PROPERTY_MAX_LEN);
+    }
+    if (fields & HINTS) {
+        cookies.hints =
+            request(id, XCB_ATOM_WM_HINTS, XCB_ATOM_WM_HINTS, WM_HINTS_LEN);
+    }
+    if (fields & TRANSIENT_FOR) {
+        cookies.transient_for =
+            request(id, XCB_ATOM_WM_TRANSIENT_FOR, XCB_ATOM_WINDOW, 1);
+    }
+    if (fields & PID) {
+        cookies.pid = request(id, atoms(m_display)[AtomID::NET_WM_PID],
+                              XCB_ATOM_CARDINAL, 1);
+    }
+    if (fields & TITLE) {
+        cookies.net_wm_name =
+            request(id, atoms(m_display)[AtomID::NET_WM_NAME],
+                    atoms(m_display)[AtomID::UTF8_STRING], PROPERTY_MAX_LEN);
+        cookies.wm_name = request(id, XCB_ATOM_WM_NAME,
+                                  XCB_GET_PROPERTY_TYPE_ANY, PROPERTY_MAX_LEN);
+    }
+    if (fields & SIZE_HINTS) {
+        cookies.size_hints = request(id, XCB_ATOM_WM_NORMAL_HINTS,
+                                     XCB_ATOM_WM_SIZE_HINTS, SIZE_HINTS_LEN);
+    }
+    if (fields & SYNC) {
+        cookies.protocols = request(id, atoms(m_display)[AtomID::WM_PROTOCOLS],
+                                    XCB_ATOM_ATOM, PROPERTY_MAX_LEN);
+        cookies.sync_counter = request(
+            id, atoms(m_display)[AtomID::NET_WM_SYNC_REQUEST_COUNTER],
+            XCB_ATOM_CARDINAL, 1);
+    }
+    if (fields & WINDOW_TYPE) {
+        cookies.window_type =
+            request(id, atoms(m_display)[AtomID::NET_WM_WINDOW_TYPE],
+                    XCB_ATOM_ATOM, PROPERTY_MAX_LEN);
+    }
+    if (fields & GEOMETRY) {
+        cookies.geometry = xcb_get_geometry(m_connection, id);
+    }
+    if (fields & STATE) {
+        cookies.state = request(id, atoms(m_display)[AtomID::NET_WM_STATE],
+                                XCB_ATOM_ATOM, PROPERTY_MAX_LEN);
+    }
+}
+
+const WindowProperties &PropertyCache::get(const Window id) {
+    prefetch(id);
+    Entry &entry = m_windows.at(id);
+    resolve(entry);
+
+    // A field changed while its request was outstanding
+    if (entry.stale) {
+        prefetch(id);
+        resolve(entry);
+    }
+    return entry.properties;
+}
+
+PropertyCache::Field PropertyCache::invalidate(const Window id,
+                                               const Atom atom) {
+    Field field = NO_FIELD;
+    switch (atom) {
+    case XA_WM_CLASS:
+        field = CLASS;
+        break;
+    case XA_WM_HINTS:
+        field = HINTS;
+        break;
+    case XA_WM_TRANSIENT_FOR:
+        field = TRANSIENT_FOR;
+        break;
+    case XA_WM_NAME:
+        field = TITLE;
+        break;
+    case XA_WM_NORMAL_HINTS:
+        field = SIZE_HINTS;
+        break;
+    default:
+        switch (atoms(m_display).find(atom).value_or(AtomID::COUNT)) {
+        case AtomID::NET_WM_PID:
+            field = PID;
+            break;
+        case AtomID::NET_WM_NAME:
+            field = TITLE;
+            break;
+        case AtomID::WM_PROTOCOLS:
+        case AtomID::NET_WM_SYNC_REQUEST_COUNTER:
+            field = SYNC;
+            break;
+        case AtomID::NET_WM_WINDOW_TYPE:
+            field = WINDOW_TYPE;
+            break;
+        case AtomID::NET_WM_STATE:
+            field = STATE;
+            break;
+        default:
+            break;
+        }
+        break;
+    }
+
+    auto it = m_windows.find(id);
+    if (it != m_windows.end()) {
+        it->second.stale |= field;
+    }
+    return field;
+}
+
+void PropertyCache::mark_stale(const Window id, const Field field) {
+    auto it = m_windows.find(id);
+    if (it != m_windows.end()) {
+        it->second.stale |= field;
+    }
+}
+
+void PropertyCache::erase(const Window id) {
+    auto it = m_windows.find(id);
+    if (it == m_windows.end()) {
+        return;
+    }
+    discard(it->second);
+    m_windows.erase(it);
+}
+
+xcb_get_property_cookie_t PropertyCache::request(const Window id,
+                                                 const Atom property,
+                                                 const Atom type,
+                                                 const uint32_t len) {
+    return xcb_get_property(m_connection, 0, id, property, type, 0, len);
+}
+
+void PropertyCache::resolve(Entry &entry) {
+    const uint32_t fields = entry.pending;
+    entry.pending = NO_FIELD;
+    WindowProperties &props = entry.properties;
+    Cookies &cookies = entry.cookies;
+
+    if (fields & ATTRIBUTES) {
+        xcb_generic_error_t *error = nullptr;
+        XcbReply<xcb_get_window_attributes_reply_t> attr(
+            xcb_get_window_attributes_reply(m_connection, cookies.attributes,
+                                            &error));
+        std::free(error);
+        props.override_redirect = attr && attr->override_redirect;
+    }
+
+    // "<instance>\0<class>\0"
+    if (fields & CLASS) {
+        XcbReply<xcb_get_property_reply_t> reply =
+            property_reply(cookies.wm_class);
+        props.res_name.clear();
+        props.res_class.clear();
+        if (reply && reply->format == 8) {
+            std::string_view value(
+                static_cast<const char *>(xcb_get_property_value(reply.get())),
+                xcb_get_property_value_length(reply.get()));
+            size_t sep = value.find('\0');
+            props.res_name = value.substr(0, sep);
+            if (sep != std::string_view::npos) {
+                std::string_view res_class = value.substr(sep + 1);
+                props.res_class = res_class.substr(0, res_class.find('\0'));
+            }
+        }
+    }
+
+    // Fields as in XWMHints: flags, input, initial_state, ...
+    if (fields & HINTS) {
+        XcbReply<xcb_get_property_reply_t> reply =
+            property_reply(cookies.hints);
+        props.initial_state.reset();
+        if (reply && reply->format == 32 &&
+            xcb_get_property_value_length(reply.get()) >=
+                static_cast<int>(3 * sizeof(uint32_t))) {
+            const uint32_t *hints = static_cast<const uint32_t *>(
+                xcb_get_property_value(reply.get()));
+            if (hints[0] & StateHint) {
+                props.initial_state = hints[2];
+            }
+        }
+    }
+
+    // Both are a single 32-bit value
+    auto cardinal = [this](const xcb_get_property_cookie_t cookie)
+        -> std::optional<uint32_t> {
+        XcbReply<xcb_get_property_reply_t> reply = property_reply(cookie);
+        if (!reply || reply->format != 32 ||
+            xcb_get_property_value_length(reply.get()) <
+                static_cast<int>(sizeof(uint32_t))) {
+            return std::nullopt;
+        }
+        return *static_cast<const uint32_t *>(
+            xcb_get_property_value(reply.get()));
+    };
+    if (fields & TRANSIENT_FOR) {
+        props.transient_for = cardinal(cookies.transient_for);
+        if (props.transient_for == None) {
+            props.transient_for.reset();
+        }
+    }
+    if (fields & PID) {
+        props.pid = cardinal(cookies.pid);
+    }
+
+    if (fields & TITLE) {
+        props.title = title_reply(entry);
+    }
+    if (fields & SIZE_HINTS) {
+        props.size_hints = size_hints_reply(entry);
+    }
+    if (fields & SYNC) {
+        props.sync_counter = sync_counter_reply(entry);
+    }
+    if (fields & WINDOW_TYPE) {
+        props.window_type = window_type_reply(entry);
+    }
+    if (fields & GEOMETRY) {
+        xcb_generic_error_t *error = nullptr;
+        XcbReply<xcb_get_geometry_reply_t> geometry(xcb_get_geometry_reply(
+            m_connection, cookies.geometry, &error));
+        std::free(error);
+        if (geometry) {
+            props.size = {.x = geometry->width, .y = geometry->height};
+        }
+    }
+    if (fields & STATE) {
+        props.fullscreen = fullscreen_reply(entry);
+    }
+}
+
+void PropertyCache::discard(Entry &entry) {
+    const uint32_t fields = entry.pending;
+    entry.pending = NO_FIELD;
+    Cookies &cookies = entry.cookies;
+
+    auto drop = [this](const unsigned int sequence) {
+        xcb_discard_reply(m_connection, sequence);
+    };
+    if (fields & ATTRIBUTES) {
+        drop(cookies.attributes.sequence);
+    }
+    if (fields & CLASS) {
+        drop(cookies.wm_class.sequence);
+    }
+    if (fields & HINTS) {
+        drop(cookies.hints.sequence);
+    }
+    if (fields & TRANSIENT_FOR) {
+        drop(cookies.transient_for.sequence);
+    }
+    if (fields & PID) {
+        drop(cookies.pid.sequence);
+    }
+    if (fields & TITLE) {
+        drop(cookies.net_wm_name.sequence);
+        drop(cookies.wm_name.sequence);
+    }
+    if (fields & SIZE_HINTS) {
+        drop(cookies.size_hints.sequence);
+    }
+    if (fields & SYNC) {
+        drop(cookies.protocols.sequence);
+        drop(cookies.sync_counter.sequence);
+    }
+    if (fields & WINDOW_TYPE) {
+        drop(cookies.window_type.sequence);
+    }
+    if (fields & GEOMETRY) {
+        drop(cookies.geometry.sequence);
+    }
+    if (fields & STATE) {
+        drop(cookies.state.sequence);
+    }
+}
+
+std::optional<std::string> PropertyCache::title_reply(Entry &entry) {
+    const Atom utf8_string = atoms(m_display)[AtomID::UTF8_STRING];
+    XcbReply<xcb_get_property_reply_t> net =
+        property_reply(entry.cookies.net_wm_name);
+    XcbReply<xcb_get_property_reply_t> wm =
+        property_reply(entry.cookies.wm_name);
+
+    auto value = [](xcb_get_property_reply_t *reply) {
+        return std::string(
+            static_cast<const char *>(xcb_get_property_value(reply)),
+            xcb_get_property_value_length(reply));
+    };
+    if (net && net->type == utf8_string && net->format == 8) {
+        return value(net.get());
+    }
+    if (!wm || wm->type == XCB_NONE || wm->format != 8) {
+        return std::nullopt;
+    }
+    if (wm->type == utf8_string) {
+        return value(wm.get());
+    }
+
+    // Usually Latin-1 or COMPOUND_TEXT, tmux expects UTF-8
+    XTextProperty name{
+        .value =
+            static_cast<unsigned char *>(xcb_get_property_value(wm.get())),
+        .encoding = wm->type,
+        .format = 8,
+        .nitems = static_cast<unsigned long>(
+            xcb_get_property_value_length(wm.get())),
+    };
+    std::optional<std::string> ret;
+    char **list = nullptr;
+    int count = 0;
+    if (Xutf8TextPropertyToTextList(m_display, &name, &list, &count) >=
+            Success &&
+        count > 0) {
+        ret.emplace(list[0]);
+    }
+    if (list) {
+        XFreeStringList(list);
+    }
+    return ret;
+}
+
+// Fields as in XSizeHints: flags, x, y, width, height, min_width, min_height,
+// max_width, max_height, width_inc, height_inc, min_aspect (2), max_aspect
+// (2), base_width, base_height, win_gravity
+SizeHints PropertyCache::size_hints_reply(Entry &entry) {
+    SizeHints ret;
+    XcbReply<xcb_get_property_reply_t> reply =
+        property_reply(entry.cookies.size_hints);
+    if (!reply || reply->format != 32 ||
+        xcb_get_property_value_length(reply.get()) <
+            static_cast<int>(SIZE_HINTS_LEN * sizeof(uint32_t))) {
+        return ret;
+    }
+    const int32_t *fields =
+        static_cast<const int32_t *>(xcb_get_property_value(reply.get()));
+    auto point = [fields](size_t i) {
+        return Point{.x = static_cast<size_t>(std::max(fields[i], 0)),
+                     .y = static_cast<size_t>(std::max(fields[i + 1], 0))};
+    };
+
+    // Per ICCCM, minimum and base sizes each default to the other
+    const uint32_t flags = fields[0];
+    if (flags & PMinSize) {
+        ret.min = point(5);
+    }
+    if (flags & PBaseSize) {
+        ret.base = point(15);
+    }
+    if (!(flags & PMinSize)) {
+        ret.min = ret.base;
+    } else if (!(flags & PBaseSize)) {
+        ret.base = ret.min;
+    }
+    if (flags & PMaxSize) {
+        ret.max = point(7);
+    }
+    if (flags & PResizeInc) {
+        ret.increment = point(9);
+        ret.increment.x = std::max<size_t>(ret.increment.x, 1);
+        ret.increment.y = std::max<size_t>(ret.increment.y, 1);
+    }
+    return ret;
+}
+
+// Both the protocol and its counter must be set
+std::optional<XSyncCounter> PropertyCache::sync_counter_reply(Entry &entry) {
+    XcbReply<xcb_get_property_reply_t> protocols =
+        property_reply(entry.cookies.protocols);
+    XcbReply<xcb_get_property_reply_t> counter =
+        property_reply(entry.cookies.sync_counter);
+    if (!protocols || protocols->format != 32 || !counter ||
+        counter->format != 32 ||
+        xcb_get_property_value_length(counter.get()) <
+            static_cast<int>(sizeof(uint32_t))) {
+        return std::nullopt;
+    }
+    const uint32_t *begin =
+        static_cast<const uint32_t *>(xcb_get_property_value(protocols.get()));
+    const uint32_t *end =
+        begin +
+        xcb_get_property_value_length(protocols.get()) / sizeof(uint32_t);
+    if (std::find(begin, end, atoms(m_display)[AtomID::NET_WM_SYNC_REQUEST]) ==
+        end) {
+        return std::nullopt;
+    }
+    return *static_cast<const uint32_t *>(
+        xcb_get_property_value(counter.get()));
+}
+
+// A list of types, most specific first
+WindowType PropertyCache::window_type_reply(Entry &entry) {
+    XcbReply<xcb_get_property_reply_t> reply =
+        property_reply(entry.cookies.window_type);
+    if (!reply || reply->format != 32) {
+        return WindowType::NORMAL;
+    }
+    const uint32_t *begin =
+        static_cast<const uint32_t *>(xcb_get_property_value(reply.get()));
+    const uint32_t *end =
+        begin + xcb_get_property_value_length(reply.get()) / sizeof(uint32_t);
+    for (const uint32_t *type = begin; type != end; type++) {
+        switch (atoms(m_display).find(*type).value_or(AtomID::COUNT)) {
+        case AtomID::NET_WM_WINDOW_TYPE_DIALOG:
+            return WindowType::DIALOG;
+        case AtomID::NET_WM_WINDOW_TYPE_UTILITY:
+            return WindowType::UTILITY;
+        case AtomID::NET_WM_WINDOW_TYPE_SPLASH:
+            return WindowType::SPLASH;
+        default:
+            break;
+        }
+    }
+    return WindowType::NORMAL;
+}
+
+bool PropertyCache::fullscreen_reply(Entry &entry) {
+    XcbReply<xcb_get_property_reply_t> reply =
+        property_reply(entry.cookies.state);
+    if (!reply || reply->format != 32) {
+        return false;
+    }
+    const uint32_t *begin =
+        static_cast<const uint32_t *>(xcb_get_property_value(reply.get()));
+    const uint32_t *end =
+        begin + xcb_get_property_value_length(reply.get()) / sizeof(uint32_t);
+    return std::find(begin, end,
+                     atoms(m_display)[AtomID::NET_WM_STATE_FULLSCREEN]) != end;
+}
+
+XcbReply<xcb_get_property_reply_t>
+PropertyCache::property_reply(const xcb_get_property_cookie_t cookie) {
+    // Windows may be destroyed before their properties are read, which is
+    // not worth reporting
+    xcb_generic_error_t *error = nullptr;
+    XcbReply<xcb_get_property_reply_t> reply(
+        xcb_get_property_reply(m_connection, cookie, &error));
+    std::free(error);
+    return reply;
+}
@@ -0,0 +1,178 @@
+/*
+ * Cache of the client properties of windows.
+ *
+ * Everything read from a window is requested in a single batch when it is
+ * created, and the replies are only waited on when first needed, so a new
+ * window costs at most one round trip. A PropertyNotify marks the one field it
+ * concerns as stale, and stale fields are fetched again, together, on the next
+ * read. Handlers otherwise read from memory.
+ */
+
+#pragma once
+
+extern "C" {
+#include <X11/Xlib.h>
+#include <X11/extensions/sync.h>
+#include <sys/types.h>
+#include <xcb/xcb.h>
+#include <xcb/xproto.h>
+}
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "layout.h"
+
+// Owns a reply from XCB, which is allocated with malloc
+struct XcbFree {
+    void operator()(void *reply) const { std::free(reply); }
+};
+template <typename T> using XcbReply = std::unique_ptr<T, XcbFree>;
+
+// Longest property read, in 32-bit units
+constexpr uint32_t PROPERTY_MAX_LEN = 1 << 16;
+
+// From _NET_WM_WINDOW_TYPE, the first type xwmux treats differently
+enum class WindowType {
+    NORMAL,
+    DIALOG,
+    UTILITY,
+    SPLASH,
+};
+
+struct WindowProperties {
+    bool override_redirect{};
+
+    // Of the window, as last read or configured by the client
+    Point size{0, 0};
+
+    // WM_CLASS
+    std::string res_name{};
+    std::string res_class{};
+
+    // From WM_HINTS
+    std::optional<int> initial_state{};
+
+    std::optional<Window> transient_for{};
+    std::optional<pid_t> pid{};
+
+    // Preferring the UTF-8 _NET_WM_NAME over WM_NAME
+    std::optional<std::string> title{};
+
+    // Sizes the client accepts
+    SizeHints size_hints{};
+
+    // If the client supports _NET_WM_SYNC_REQUEST
+    std::optional<XSyncCounter> sync_counter{};
+
+    WindowType window_type{WindowType::NORMAL};
+
+    // _NET_WM_STATE_FULLSCREEN, as set by the client before mapping
+    bool fullscreen{};
+
+    // Dialogs and the like float over their parent, rather than taking a
+    // pane of their own
+    bool floating() const {
+        return transient_for.has_value() ||
+               window_type != WindowType::NORMAL;
+    }
+};
+
+class PropertyCache {
+  public:
+    // Parts of WindowProperties, each fetched by its own requests
+    enum Field : uint32_t {
+        NO_FIELD = 0,
+        ATTRIBUTES = 1 << 0,
+        CLASS = 1 << 1,
+        HINTS = 1 << 2,
+        TRANSIENT_FOR = 1 << 3,
+        PID = 1 << 4,
+        TITLE = 1 << 5,
+        SIZE_HINTS = 1 << 6,
+        SYNC = 1 << 7,
+        WINDOW_TYPE = 1 << 8,
+        GEOMETRY = 1 << 9,
+        STATE = 1 << 10,
+        ALL_FIELDS = (1 << 11) - 1,
+    };
+
+    PropertyCache(Display *display, xcb_connection_t *connection)
+        : m_display(display), m_connection(connection) {}
+
+    PropertyCache(const PropertyCache &other) = delete;
+    PropertyCache &operator=(const PropertyCache &other) = delete;
+
+    // Request what is missing or stale, without waiting on the replies. The
+    // window is also watched for property changes from then on.
+    void prefetch(const Window id);
+
+    // Properties of a window, waiting on any outstanding requests
+    const WindowProperties &get(const Window id);
+
+    // A property of the window has changed, returns the field it belongs to
+    Field invalidate(const Window id, const Atom atom);
+
+    // Fields changed other than by a property, e.g. the window's geometry
+    void mark_stale(const Window id, const Field field);
+
+    // The window is destroyed
+    void erase(const Window id);
+
+  private:
+    struct Cookies {
+        xcb_get_window_attributes_cookie_t attributes{};
+        xcb_get_property_cookie_t wm_class{};
+        xcb_get_property_cookie_t hints{};
+        xcb_get_property_cookie_t transient_for{};
+        xcb_get_property_cookie_t pid{};
+        xcb_get_property_cookie_t net_wm_name{};
+        xcb_get_property_cookie_t wm_name{};
+        xcb_get_property_cookie_t size_hints{};
+        xcb_get_property_cookie_t protocols{};
+        xcb_get_property_cookie_t sync_counter{};
+        xcb_get_property_cookie_t window_type{};
+        xcb_get_geometry_cookie_t geometry{};
+        xcb_get_property_cookie_t state{};
+    };
+
+    struct Entry {
+        WindowProperties properties{};
+
+        // Fields to request, and fields requested but not yet read
+        uint32_t stale{ALL_FIELDS};
+        uint32_t pending{};
+        Cookies cookies{};
+    };
+
+    xcb_get_property_cookie_t request(const Window id, const Atom property,
+                                      const Atom type, const uint32_t len);
+
+    // Read the replies of the pending fields
+    void resolve(Entry &entry);
+
+    // Drop replies which will not be read
+    void discard(Entry &entry);
+
+    std::optional<std::string> title_reply(Entry &entry);
+    SizeHints size_hints_reply(Entry &entry);
+    std::optional<XSyncCounter> sync_counter_reply(Entry &entry);
+    WindowType window_type_reply(Entry &entry);
+    bool fullscreen_reply(Entry &entry);
+
+    XcbReply<xcb_get_property_reply_t>
+    property_reply(const xcb_get_property_cookie_t cookie);
+
+    // Number of 32-bit fields in WM_HINTS and WM_NORMAL_HINTS
+    static constexpr uint32_t WM_HINTS_LEN = 9;
+    static constexpr uint32_t SIZE_HINTS_LEN = 18;
+
+    Display *m_display;
+    xcb_connection_t *m_connection;
+    std::unordered_map<Window, Entry> m_windows;
+};
@@ -0,0 +1,102 @@
+/*
+ * Rate limit for window geometry while panes are being resized.
+ *
+ * Interactive resizes move every affected pane on each step. The first change
+ * to a window after a quiet interval is applied at once, later changes within
+ * the interval are held back, and only the last of them is applied once it is
+ * up. The final layout is therefore always applied, exactly once.
+ */
+
+#pragma once
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "layout.h"
+#include "timers.h"
+
+// Maximum geometry changes per second, per window (0 for no limit)
+const std::string RESIZE_RATE_VAR = "XWMUX_RESIZE_RATE";
+constexpr int DEFAULT_RESIZE_RATE = 60;
+
+class ResizeDebouncer {
+  public:
+    using Clock = Timers::Clock;
+    using Apply = std::function<void(Window, const WindowPosition &)>;
+
+    ResizeDebouncer(Apply apply)
+        : m_apply(std::move(apply)), m_interval(interval_from_env()) {}
+
+    void update(const Window window, const WindowPosition &pos) {
+        Debounced &state = m_windows[window];
+        if (state.timer.has_value()) {
+            state.pending = pos;
+            return;
+        }
+
+        const Clock::time_point now = Clock::now();
+        if (now >= state.applied + m_interval) {
+            state.applied = now;
+            m_apply(window, pos);
+            return;
+        }
+
+        state.pending = pos;
+        state.timer = timers().add(state.applied + m_interval,
+                                   [this, window] { apply_pending(window); });
+    }
+
+    // Drop held back changes to a window which is no longer managed
+    void forget(const Window window) {
+        auto it = m_windows.find(window);
+        if (it == m_windows.end()) {
+            return;
+        }
+        if (it->second.timer.has_value()) {
+            timers().cancel(it->second.timer.value());
+        }
+        m_windows.erase(it);
+    }
+
+  private:
+    struct Debounced {
+        Clock::time_point applied{};
+        std::optional<WindowPosition> pending{};
+        std::optional<Timers::TimerID> timer{};
+    };
+
+    void apply_pending(const Window window) {
+        Debounced &state = m_windows[window];
+        state.timer.reset();
+        state.applied = Clock::now();
+        if (state.pending.has_value()) {
+            WindowPosition pos = state.pending.value();
+            state.pending.reset();
+            m_apply(window, pos);
+        }
+    }
+
+    static Clock::duration interval_from_env() {
+        const char *value = std::getenv(RESIZE_RATE_VAR.c_str());
+        int rate = value ? std::atoi(value) : DEFAULT_RESIZE_RATE;
+        if (rate <= 0) {
+            return Clock::duration::zero();
+        }
+        return std::chrono::duration_cast<Clock::duration>(
+            std::chrono::seconds(1)) /
+               rate;
+    }
+
+    Apply m_apply;
+    const Clock::duration m_interval;
+    std::unordered_map<Window, Debounced> m_windows;
+};
@@ -0,0 +1,74 @@
+#include "timers.h"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <ctime>
+
+Timers::Timers()
+    : m_timer_fd(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) {
+}
+
+Timers::~Timers() { close(m_timer_fd); }
+
+Timers::TimerID Timers::add(const Clock::time_point deadline,
+                            Callback callback) {
+    TimerID id = m_next_id++;
+    m_timers.emplace(std::pair{deadline, id}, std::move(callback));
+    m_deadlines.emplace(id, deadline);
+    if (m_timers.begin()->first.second == id) {
+        arm();
+    }
+    return id;
+}
+
+void Timers::cancel(const TimerID id) {
+    auto it = m_deadlines.find(id);
+    if (it == m_deadlines.end()) {
+        return;
+    }
+    m_timers.erase({it->second, id});
+    m_deadlines.erase(it);
+    arm();
+}
+
+void Timers::dispatch() {
+    uint64_t count;
+    if (read(m_timer_fd, &count, sizeof(count)) < 0) {
+        // Not expired, there may still be timers due
+    }
+
+    // Callbacks may add or cancel timers, so take one at a time
+    const Clock::time_point now = Clock::now();
+    while (!m_timers.empty() && m_timers.begin()->first.first <= now) {
+        auto node = m_timers.extract(m_timers.begin());
+        m_deadlines.erase(node.key().second);
+        node.mapped()();
+    }
+    arm();
+}
+
+void Timers::arm() {
+    // All zero disarms the timer
+    itimerspec spec{};
+    if (!m_timers.empty()) {
+        // steady_clock is CLOCK_MONOTONIC
+        using namespace std::chrono;
+        auto deadline = m_timers.begin()->first.first.time_since_epoch();
+        auto secs = duration_cast<seconds>(deadline);
+        spec.it_value.tv_sec = secs.count();
+        spec.it_value.tv_nsec = duration_cast<nanoseconds>(deadline - secs)
+                                    .count();
+
+        // Zero would disarm it, the deadline has passed anyway
+        if (!spec.it_value.tv_sec && !spec.it_value.tv_nsec) {
+            spec.it_value.tv_nsec = 1;
+        }
+    }
+    timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+Timers &timers() {
+    static Timers instance;
+    return instance;
+}
@@ -0,0 +1,55 @@
+/*
+ * One-shot timers for the main loop.
+ *
+ * All timers share a single timerfd, armed for the earliest deadline, which
+ * the main loop polls alongside the X connection. Expired timers are run from
+ * dispatch(), on the main thread.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+class Timers {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using Callback = std::function<void()>;
+    using TimerID = uint64_t;
+
+    Timers();
+    ~Timers();
+
+    Timers(const Timers &other) = delete;
+    Timers &operator=(const Timers &other) = delete;
+
+    // Run a callback once the deadline has passed
+    TimerID add(const Clock::time_point deadline, Callback callback);
+
+    // Does nothing if the timer has already run
+    void cancel(const TimerID id);
+
+    // Run expired timers, on the main thread
+    void dispatch();
+
+    // Readable once the earliest timer has expired
+    int fd() const { return m_timer_fd; }
+
+  private:
+    // Set the timerfd to the earliest deadline, or disarm it
+    void arm();
+
+    int m_timer_fd;
+    TimerID m_next_id{};
+
+    // Ordered by deadline, then by creation
+    std::map<std::pair<Clock::time_point, TimerID>, Callback> m_timers;
+    std::unordered_map<TimerID, Clock::time_point> m_deadlines;
+};
+
+// Timers shared by the main loop
+Timers &timers();
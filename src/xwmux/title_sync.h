@@ -0,0 +1,84 @@
+/*
+ * Rate limited synchronisation of X window titles to tmux pane titles.
+ *
+ * Some clients (browsers, download managers, progress bars) retitle their
+ * windows many times a second. Titles are only sent when changed, and all
+ * titles changed within an interval are sent together, keeping only the last
+ * title of each pane.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "layout.h"
+#include "timers.h"
+#include "tmux.h"
+
+// Minimum time between batches of titles, in milliseconds
+const std::string TITLE_INTERVAL_VAR = "XWMUX_TITLE_INTERVAL";
+constexpr int DEFAULT_TITLE_INTERVAL = 200;
+
+class TitleSync {
+  public:
+    using Clock = Timers::Clock;
+
+    TitleSync() : m_interval(interval_from_env()) {}
+
+    // Queue a new title for a pane, dropped if it has not changed
+    void update(const TmuxPaneID tm_pane, std::string title) {
+        auto sent = m_sent.find(tm_pane);
+        if (sent != m_sent.end() && sent->second == title) {
+            // Changed back before being sent
+            m_pending.erase(tm_pane);
+            return;
+        }
+        m_pending.insert_or_assign(tm_pane, std::move(title));
+
+        // Idle for an interval: send straight away
+        if (!m_timer.has_value()) {
+            m_timer = timers().add(
+                std::max(Clock::now(), m_last_flush + m_interval), [this] {
+                    m_timer.reset();
+                    flush();
+                });
+        }
+    }
+
+    // Stop tracking a pane which no longer holds a window
+    void forget(const TmuxPaneID tm_pane) {
+        m_sent.erase(tm_pane);
+        m_pending.erase(tm_pane);
+    }
+
+  private:
+    // Send all pending titles
+    void flush() {
+        for (auto &[tm_pane, title] : m_pending) {
+            name_pane(tm_pane, title);
+            m_sent.insert_or_assign(tm_pane, std::move(title));
+        }
+        m_pending.clear();
+        m_last_flush = Clock::now();
+    }
+
+    static std::chrono::milliseconds interval_from_env() {
+        const char *value = std::getenv(TITLE_INTERVAL_VAR.c_str());
+        int interval = value ? std::atoi(value) : DEFAULT_TITLE_INTERVAL;
+        return std::chrono::milliseconds(std::max(interval, 0));
+    }
+
+    const std::chrono::milliseconds m_interval;
+
+    std::unordered_map<TmuxPaneID, std::string> m_sent;
+    std::unordered_map<TmuxPaneID, std::string> m_pending;
+
+    // Flushes the pending titles
+    std::optional<Timers::TimerID> m_timer;
+    Clock::time_point m_last_flush;
+};
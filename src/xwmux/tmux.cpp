@@ -1,57 +1,260 @@
 #include "tmux.h"
 #include "log.h"
 
+#include <algorithm>
+#include <chrono>
 #include <format>
+#include <optional>
 #include <string>
+#include <unordered_map>
 
-void split_window() {
-    if (std::system("tmux split-window '' \\; break-pane")) {
-        log_msg("Failed to spawn window.\n");
+TmuxControl &tmux_control() {
+    static TmuxControl control(TMUX_SESSION);
+    return control;
+}
+
+// Log a message if the command fails
+static TmuxControl::Callback log_failure(const std::string_view msg) {
+    return [msg = std::string(msg)](const TmuxReply &reply) {
+        if (!reply.ok) {
+            log_msg(msg);
+        }
     };
 }
 
+// Session of the root terminal with the input focus
+static std::string s_session = TMUX_SESSION;
+
+// Both are needed on every prefix press, so are looked up ahead of time.
+// Root terminals' clients are kept by session.
+static std::unordered_map<std::string, std::string> s_term_clients;
+static std::optional<std::string> s_prefix;
+
+static LatencyStats s_prefix_latency("prefix");
+
+using ClientCallback = std::function<void(const std::optional<std::string> &)>;
+
+// The control client is a client too, so commands acting on "the current
+// client" must name the root terminal's client explicitly.
+// Called back immediately if known, otherwise once tmux has replied, so the
+// event loop never waits on it. Replies arrive in order, so commands sent
+// from callbacks keep the order they were requested in.
+static void with_term_client(const std::string &session,
+                             ClientCallback callback) {
+    auto it = s_term_clients.find(session);
+    if (it != s_term_clients.end()) {
+        if (callback) {
+            callback(it->second);
+        }
+        return;
+    }
+    tmux_control().send(
+        std::format("list-clients -t {} -F '#{{client_control_mode}} "
+                    "#{{client_name}}'",
+                    tmux_quote("=" + session)),
+        [session, callback = std::move(callback)](const TmuxReply &reply) {
+            std::optional<std::string> client;
+            for (const std::string &line : reply.lines) {
+                if (line.starts_with("0 ")) {
+                    client = s_term_clients[session] = line.substr(2);
+                    break;
+                }
+            }
+            if (callback) {
+                callback(client);
+            }
+        });
+}
+
+void update_term_client(const std::string_view session) {
+    with_term_client(std::string(session), {});
+}
+
+void forget_term_client() { s_term_clients.clear(); }
+
+void focus_session(const std::string_view session) { s_session = session; }
+
+bool is_term_client(const std::string_view session,
+                    const std::string_view client) {
+    auto it = s_term_clients.find(std::string(session));
+    return it != s_term_clients.end() && it->second == client;
+}
+
+void query_term_size(const std::string_view session,
+                     std::function<void(Resolution, Resolution)> callback) {
+    tmux_control().send(
+        std::format("list-clients -t {} -F '#{{client_control_mode}} "
+                    "#{{client_width}} #{{client_height}} "
+                    "#{{client_cell_width}} #{{client_cell_height}}'",
+                    tmux_quote("=" + std::string(session))),
+        [callback = std::move(callback)](const TmuxReply &reply) {
+            if (!reply.ok) {
+                return;
+            }
+            for (const std::string &line : reply.lines) {
+                // Cells are 0 or empty if unknown
+                int control, width, height, cell_width = 0, cell_height = 0;
+                if (std::sscanf(line.c_str(), "%d %d %d %d %d", &control,
+                                &width, &height, &cell_width,
+                                &cell_height) >= 3 &&
+                    !control && width > 0 && height > 0) {
+                    callback({static_cast<size_t>(width),
+                              static_cast<size_t>(height)},
+                             {static_cast<size_t>(cell_width),
+                              static_cast<size_t>(cell_height)});
+                    return;
+                }
+            }
+        });
+}
+
+void query_control_mode(const std::string_view client,
+                        std::function<void(bool)> callback) {
+    tmux_control().send(
+        std::format("display-message -p -c {} '#{{client_control_mode}}'",
+                    tmux_quote(client)),
+        [callback = std::move(callback)](const TmuxReply &reply) {
+            if (reply.ok && !reply.lines.empty()) {
+                callback(reply.lines.front() == "1");
+            }
+        });
+}
+
+static void send_client_keys(const std::string_view key,
+                             TmuxControl::Callback callback) {
+    with_term_client(
+        s_session, [key = std::string(key), callback = std::move(callback)](
+                       const std::optional<std::string> &client) {
+            if (!client.has_value()) {
+                callback({.ok = false, .lines = {}});
+                return;
+            }
+            tmux_control().send(std::format("send-keys -K -c {} {}",
+                                            tmux_quote(client.value()),
+                                            tmux_quote(key)),
+                                callback);
+        });
+}
+
+void split_window(TmuxControl &control) {
+    // One command per line, so each gets its own reply
+    control.send("split-window ''", log_failure("Failed to spawn window.\n"));
+    control.send("break-pane", log_failure("Failed to spawn window.\n"));
+}
+
 void send_message(const std::string_view msg) {
-    std::string fail_str = "";
-    if (std::system(std::format("tmux display-message '{}'", msg).c_str())) {
-        fail_str = " (FAILED)";
+    auto log_sent = [msg = std::string(msg)](const bool ok) {
+        log_msg(std::format("Sending message: {}{}\n", msg,
+                            ok ? "" : " (FAILED)"));
     };
-    log_msg(std::format("Sending message: {}{}\n", msg, fail_str));
+    with_term_client(s_session, [msg = std::string(msg), log_sent](
+                                    const std::optional<std::string> &client) {
+        if (!client.has_value()) {
+            log_sent(false);
+            return;
+        }
+        tmux_control().send(std::format("display-message -c {} {}",
+                                        tmux_quote(client.value()),
+                                        tmux_quote(msg)),
+                            [log_sent](const TmuxReply &reply) {
+                                log_sent(reply.ok);
+                            });
+    });
 }
 
 void kill_pane(const TmuxPaneID tm_pane) {
-    if (std::system(std::format("tmux kill-pane -t %{}", tm_pane).c_str())) {
-        log_msg("Failed to kill pane.\n");
-    };
+    tmux_control().send(std::format("kill-pane -t %{}", tm_pane),
+                        log_failure("Failed to kill pane.\n"));
 }
 
 void focus_location(const TmuxPaneID tm_pane) {
-    if (std::system(std::format("tmux select-pane -t %{}", tm_pane).c_str())) {
-        log_msg("Failed to focus location.\n");
-    };
+    tmux_control().send(std::format("select-pane -t %{}", tm_pane),
+                        log_failure("Failed to focus location.\n"));
 }
 
 void name_pane(const TmuxPaneID tm_pane, const std::string_view name) {
-    std::string name_clean;
-    for (char c : name) {
-        if (c == '\'') {
-            name_clean.append("'\\'");
+    tmux_control().send(
+        std::format("select-pane -t %{} -T {}", tm_pane, tmux_quote(name)),
+        log_failure("Failed to name pane.\n"));
+}
+
+void update_prefix() {
+    tmux_control().send("show-options -gv prefix", [](const TmuxReply &reply) {
+        if (reply.ok && !reply.lines.empty()) {
+            s_prefix = reply.lines.front();
         }
-        name_clean.push_back(c);
-    }
-    if (std::system(
-            std::format("tmux select-pane -t %{} -T '{}'", tm_pane, name_clean)
-                .c_str())) {
-        log_msg("Failed to name pane.\n");
-    };
+    });
 }
 
 void send_prefix() {
-    if (std::system(
-            "tmux send-keys -K $(tmux show-option prefix | cut -f 2 -d ' ')")) {
-        log_msg("Failed to send prefix.\n");
+    // Time until tmux has handled the key
+    auto start = std::chrono::steady_clock::now();
+    auto send = [start] {
+        send_client_keys(s_prefix.value(), [start](const TmuxReply &reply) {
+            if (!reply.ok) {
+                log_msg("Failed to send prefix.\n");
+                return;
+            }
+            s_prefix_latency.record(std::chrono::steady_clock::now() - start);
+        });
     };
-};
+    if (s_prefix.has_value()) {
+        send();
+        return;
+    }
 
-bool find_pane(const TmuxPaneID tm_pane) {
-    return !(std::system(std::format("tmux has -t %{}", tm_pane).c_str()));
+    // Not looked up yet, send once it is
+    tmux_control().send("show-options -gv prefix",
+                        [send](const TmuxReply &reply) {
+                            if (!reply.ok || reply.lines.empty()) {
+                                log_msg("Failed to send prefix.\n");
+                                return;
+                            }
+                            s_prefix = reply.lines.front();
+                            send();
+                        });
 };
+
+void send_keys(const std::string_view key) {
+    send_client_keys(key,
+                     log_failure(std::format("Failed to send {}.\n", key)));
+}
+
+void query_pane_ids(
+    std::function<void(const std::vector<TmuxPaneID> &)> callback) {
+    tmux_control().send(
+        "list-panes -a -F '#{pane_id}'",
+        [callback = std::move(callback)](const TmuxReply &reply) {
+            // Without an answer, every pane would look orphaned
+            if (!reply.ok) {
+                return;
+            }
+            std::vector<TmuxPaneID> panes;
+            for (const std::string &line : reply.lines) {
+                if (line.starts_with('%')) {
+                    panes.push_back(std::atoi(line.c_str() + 1));
+                }
+            }
+            std::sort(panes.begin(), panes.end());
+            callback(panes);
+        });
+}
+
+void query_panes(
+    TmuxControl &control,
+    std::function<void(const std::vector<TmuxPaneReport> &)> callback) {
+    control.send(
+        std::format("list-panes -F {}", tmux_quote(PANE_REPORT_FORMAT)),
+        [callback = std::move(callback)](const TmuxReply &reply) {
+            if (!reply.ok) {
+                return;
+            }
+            callback(parse_pane_reports(reply.lines));
+        });
+}
+
+void follow_session(TmuxControl &control, const std::string_view session_id) {
+    control.send(
+        std::format("switch-client -t {}", tmux_quote(session_id)),
+        log_failure("Failed to follow session.\n"));
+}
@@ -1,23 +1,116 @@
 /*
  * Internal represetntations of tmux state, and helpers for interacting with
- * tmux via cli.
+ * tmux via the control mode client.
  */
 
 #pragma once
 
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
+#include <functional>
+#include <optional>
+#include <string>
 #include <string_view>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
 
+#include "tmux_control.h"
 #include "xwrapper.h"
 
-using TmuxWindowID = int32_t;
-using TmuxPaneID = int32_t;
-
 using TmuxLocation = std::pair<TmuxWindowID, TmuxPaneID>;
 
-void split_window();
+// Session attached to by the root terminal of the first output (see
+// xwmux-init-term.sh). Other outputs get their own sessions.
+const std::string TMUX_SESSION = "default";
+
+// Connection to TMUX_SESSION, shared by all helpers below. Helpers acting on
+// a session's current window take that session's connection instead.
+TmuxControl &tmux_control();
+
+// State of a single pane, as reported by tmux
+struct TmuxPaneReport {
+    TmuxLocation location;
+    WindowPosition position;
+    bool focused;
+    bool zoomed;
+    bool dead;
+
+    // Session the pane was reported from, which picks the head for windows
+    // not seen yet. Unset if the reporter did not say.
+    std::optional<TmuxSessionID> session{};
+
+    // Parse a line output in PANE_REPORT_FORMAT, the session may be left off
+    static std::optional<TmuxPaneReport> parse(const std::string_view line) {
+        int focused, zoomed, dead;
+        TmuxWindowID tm_window;
+        TmuxPaneID tm_pane;
+        TmuxSessionID session;
+        size_t left, top, width, height;
+        int n = std::sscanf(std::string(line).c_str(),
+                            "%d %d @%d %%%d %zu %zu %zu %zu %d $%d", &focused,
+                            &zoomed, &tm_window, &tm_pane, &left, &top, &width,
+                            &height, &dead, &session);
+        if (n < 9) {
+            return std::nullopt;
+        }
+        return TmuxPaneReport{
+            .location = {tm_window, tm_pane},
+            .position = {.start = {left, top},
+                         .end = {left + width, top + height}},
+            .focused = static_cast<bool>(focused),
+            .zoomed = static_cast<bool>(zoomed),
+            .dead = static_cast<bool>(dead),
+            .session = n == 10 ? std::optional(session) : std::nullopt,
+        };
+    }
+};
+
+constexpr std::string_view PANE_REPORT_FORMAT =
+    "#{pane_active} #{window_zoomed_flag} #{window_id} #{pane_id} "
+    "#{pane_left} #{pane_top} #{pane_width} #{pane_height} #{pane_dead} "
+    "#{session_id}";
+
+// Parse list-panes output, focused pane first
+inline std::vector<TmuxPaneReport>
+parse_pane_reports(const std::vector<std::string> &lines) {
+    std::vector<TmuxPaneReport> panes;
+    for (const std::string &line : lines) {
+        if (std::optional<TmuxPaneReport> pane = TmuxPaneReport::parse(line)) {
+            panes.push_back(pane.value());
+        }
+    }
+    std::stable_partition(
+        panes.begin(), panes.end(),
+        [](const TmuxPaneReport &pane) { return pane.focused; });
+    return panes;
+}
+
+// Report all panes in the current window, focused pane first
+void query_panes(
+    TmuxControl &control,
+    std::function<void(const std::vector<TmuxPaneReport> &)> callback);
+
+// Move the control client to the session the root terminal switched to
+void follow_session(TmuxControl &control, const std::string_view session_id);
+
+void split_window(TmuxControl &control);
+
+// Keys and messages go to the root terminal attached to this session
+void focus_session(const std::string_view session);
+
+// True if the client is known to be the root terminal's of the session
+bool is_term_client(const std::string_view session,
+                    const std::string_view client);
+
+// Report the size of the session's root terminal, in characters, and of its
+// cells in pixels (zero if the terminal does not tell tmux)
+void query_term_size(const std::string_view session,
+                     std::function<void(Resolution, Resolution)> callback);
+
+// Report whether a client is a control client, like xwmux's own
+void query_control_mode(const std::string_view client,
+                        std::function<void(bool)> callback);
 
 void send_message(const std::string_view msg);
 
@@ -27,9 +120,23 @@ void focus_location(const TmuxPaneID tm_pane);
 
 void name_pane(const TmuxPaneID tm_pane, const std::string_view name);
 
+// Look up the prefix (in tmux's format) ahead of send_prefix()
+void update_prefix();
+
 void send_prefix();
 
-bool find_pane(const TmuxPaneID tm_pane);
+// Send a key as if typed in the root terminal's client
+void send_keys(const std::string_view key);
+
+// Look up root terminals' clients again, e.g. after one has detached
+void forget_term_client();
+
+// Look up the root terminal's client of a session ahead of send_keys()
+void update_term_client(const std::string_view session);
+
+// Report the IDs of all panes on the server, sorted
+void query_pane_ids(
+    std::function<void(const std::vector<TmuxPaneID> &)> callback);
 
 // Represents a tmux pane containing an X11 window
 struct WindowPane {
@@ -48,8 +155,8 @@ struct WindowPane {
 
     void notify_unmapped() { m_unmap_req_count--; }
 
-    void show(const XState &state) {
-        XMapWindow(state.display, m_window);
+    void show(XState &state) {
+        state.show(m_window);
         m_hidden = false;
     }
 
@@ -63,34 +170,31 @@ struct WindowPane {
         XEvent ev;
         ev.xclient.type = ClientMessage;
         ev.xclient.window = m_window;
-        ev.xclient.message_type = XInternAtom(display, "WM_PROTOCOLS", true);
+        ev.xclient.message_type = atoms(display)[AtomID::WM_PROTOCOLS];
         ev.xclient.format = 32;
-        ev.xclient.data.l[0] = XInternAtom(display, "WM_DELETE_WINDOW", false);
+        ev.xclient.data.l[0] = atoms(display)[AtomID::WM_DELETE_WINDOW];
         ev.xclient.data.l[1] = CurrentTime;
         XSendEvent(display, m_window, False, NoEventMask, &ev);
     }
 
-    void hide(const XState &state) {
-        XUnmapWindow(state.display, m_window);
+    void hide(XState &state) {
+        if (state.hide(m_window)) {
+            m_unmap_req_count++;
+        }
         m_hidden = true;
-        m_unmap_req_count++;
-    }
-
-    void set_position(const XState &state, const WindowPosition &pos) {
-        pos.resize_to(state.display, m_window);
     }
 
   private:
-    Window m_window;
-    bool m_hidden;
+    Window m_window{};
+    bool m_hidden{};
 
     // If requested to die, but no destroy notification yet
     // Avoid double sending requests
-    bool m_dying;
+    bool m_dying{};
 
     // To differentiate unmap notifications originating from xwmux and the
     // application, keep track of the number of pending unmap requests.
-    size_t m_unmap_req_count;
+    size_t m_unmap_req_count{};
 };
 
 // Represents a tmux window and all associated WindowPanes
@@ -98,11 +202,10 @@ struct Workspace {
   public:
     Workspace() = default;
 
-    void add_window(const XState &state, const TmuxPaneID tm_pane,
-                    const Window window) {
+    void add_window(XState &state, const TmuxPaneID tm_pane,
+                    const Window window, const WindowPosition &position) {
         m_app_windows[tm_pane] = window;
-        state.term_layout.fullscreen_term_position().resize_to(state.display,
-                                                               window);
+        state.move_resize(window, position);
     }
 
     void erase_pane(const TmuxPaneID tm_pane) {
@@ -123,13 +226,13 @@ struct Workspace {
         return m_app_windows;
     }
 
-    void show(const XState &state) {
+    void show(XState &state) {
         for (auto &[p, w] : m_app_windows) {
             w.show(state);
         }
     }
 
-    void show(const XState &state, const TmuxPaneID zoomed) {
+    void show(XState &state, const TmuxPaneID zoomed) {
         for (auto &[p, w] : m_app_windows) {
             if (p == zoomed) {
                 w.show(state);
@@ -139,7 +242,7 @@ struct Workspace {
         }
     }
 
-    void hide(const XState &state) {
+    void hide(XState &state) {
         for (auto &[p, w] : m_app_windows) {
             w.hide(state);
         }
@@ -166,9 +269,12 @@ struct TmuxXWindowMapping {
         return m_workspaces.at(m_active.first);
     }
 
-    void add_window(const XState &state, const Window window,
-                    const TmuxLocation location) {
-        m_workspaces[location.first].add_window(state, location.second, window);
+    // Placed at the given position until its pane is reported
+    void add_window(XState &state, const Window window,
+                    const TmuxLocation location,
+                    const WindowPosition &position) {
+        m_workspaces[location.first].add_window(state, location.second, window,
+                                                position);
         m_inverse_map[window] = location.second;
         m_inverse_tm_map[location.second] = location.first;
     }
@@ -280,19 +386,53 @@ struct TmuxXWindowMapping {
 
     bool overridden() const { return m_overriden; }
 
-    // TODO: do this in linear time w/ two sorted lists
-    std::unordered_set<Window> find_orphans() {
-        std::unordered_set<Window> ret;
+    // Root terminal of the head, focused when the active pane has no window
+    std::optional<Window> term() const { return m_term; }
+    void set_term(const std::optional<Window> term) { m_term = term; }
+
+    // Only the focused head moves the input focus, which is taken on
+    // becoming focused
+    void set_focused(XState &state, const bool focused) {
+        m_focused = focused;
+        if (focused) {
+            focus_pane(state, m_active, true);
+        }
+    }
+
+    // Hide every window, until a tmux window is activated again
+    void hide_all(XState &state) {
+        for (auto &[tm_window, workspace] : m_workspaces) {
+            workspace.hide(state);
+        }
+        m_active.first = -1;
+    }
+
+    // Windows whose panes are not among the live panes (sorted), merging the
+    // two sorted lists of panes in one pass
+    std::vector<Window>
+    find_orphans(const std::vector<TmuxPaneID> &live_panes) const {
+        std::vector<std::pair<TmuxPaneID, Window>> mapped;
+        mapped.reserve(m_inverse_map.size());
         for (auto [w, tm_pane] : m_inverse_map) {
-            if (!find_pane(tm_pane)) {
-                ret.insert(w);
+            mapped.emplace_back(tm_pane, w);
+        }
+        std::sort(mapped.begin(), mapped.end());
+
+        std::vector<Window> ret;
+        auto live = live_panes.begin();
+        for (auto [tm_pane, w] : mapped) {
+            while (live != live_panes.end() && *live < tm_pane) {
+                live++;
+            }
+            if (live == live_panes.end() || *live != tm_pane) {
+                ret.push_back(w);
             }
         }
         return ret;
     }
 
   private:
-    void activate_window(const XState &state, TmuxWindowID tm_window,
+    void activate_window(XState &state, TmuxWindowID tm_window,
                          std::optional<TmuxPaneID> zoomed_pane) {
         if (m_active.first != tm_window) {
 
@@ -307,6 +447,7 @@ struct TmuxXWindowMapping {
         } else {
             m_workspaces[tm_window].show(state);
         }
+        state.restack();
         m_active.first = tm_window;
     }
 
@@ -317,6 +458,13 @@ struct TmuxXWindowMapping {
 
         if (m_active != location || redundant_refocus) {
 
+            // Another head has the input focus
+            if (!m_focused) {
+                m_active.second = location.second;
+                m_overriden = false;
+                return;
+            }
+
             // If workspace has gui window at location, focus it
             bool has_x_window =
                 m_workspaces[location.first].get_windows().count(
@@ -325,7 +473,7 @@ struct TmuxXWindowMapping {
             Window target =
                 has_x_window
                     ? m_workspaces[location.first][location.second].get_window()
-                    : state.term.value_or(state.root);
+                    : m_term.value_or(state.root);
 
             if (has_x_window) {
                 state.grab_prefix();
@@ -349,5 +497,8 @@ struct TmuxXWindowMapping {
     TmuxLocation m_active{-1, -1};
 
     // Active location has a gui window which is overridden
-    bool m_overriden;
+    bool m_overriden{};
+
+    std::optional<Window> m_term;
+    bool m_focused{};
 };
@@ -0,0 +1,247 @@
+#include "tmux_control.h"
+#include "launcher.h"
+#include "log.h"
+
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <utility>
+
+bool TmuxControl::send(std::string_view cmd, Callback callback) {
+    if (!connect()) {
+        if (callback) {
+            callback({.ok = false, .lines = {}});
+        }
+        return false;
+    }
+
+    std::string line(cmd);
+    line.push_back('\n');
+
+    // Register the callback first, replies arrive in command order
+    m_pending.push_back(std::move(callback));
+
+    // Commands written before the attach completes run outside the session
+    if (!m_attached) {
+        m_held.push_back(std::move(line));
+        return true;
+    }
+    write_line(std::move(line));
+    return true;
+}
+
+void TmuxControl::write_line(std::string line) {
+    // Writing blocks while tmux is busy, so leave it to the executor.
+    // Errors show up as EOF on the main thread.
+    m_executor.post([in = m_in, line = std::move(line)] {
+        std::string_view rest = line;
+        while (!rest.empty()) {
+            ssize_t n = write(in, rest.data(), rest.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0) {
+                return;
+            }
+            rest.remove_prefix(n);
+        }
+    });
+}
+
+void TmuxControl::dispatch() {
+    if (connected()) {
+        fill_buffer();
+        process_buffer();
+    }
+}
+
+std::optional<std::string> TmuxControl::next_notification() {
+    if (m_notifications.empty()) {
+        return std::nullopt;
+    }
+    std::string ret = std::move(m_notifications.front());
+    m_notifications.pop_front();
+    return ret;
+}
+
+bool TmuxControl::connect() {
+    if (connected()) {
+        return true;
+    }
+
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC)) {
+        return false;
+    }
+    if (pipe2(out, O_CLOEXEC)) {
+        close(in[0]);
+        close(in[1]);
+        return false;
+    }
+
+    // Not nested, even if xwmux was started from within tmux
+    pid_t pid = launcher().spawn(
+        {"tmux", "-C", "new-session", "-A", "-s", m_session}, {},
+        {.stdin_fd = in[0], .stdout_fd = out[1], .unset_env = {"TMUX"}});
+    if (pid < 0) {
+        for (int fd : {in[0], in[1], out[0], out[1]}) {
+            close(fd);
+        }
+        return false;
+    }
+
+    close(in[0]);
+    close(out[1]);
+    m_pid = pid;
+    m_in = in[1];
+    m_out = out[0];
+    fcntl(m_out, F_SETFL, fcntl(m_out, F_GETFL) | O_NONBLOCK);
+    m_poller.add(m_out);
+
+    // Do not die with the client, its stdin is a pipe so writes can't pass
+    // MSG_NOSIGNAL. Children are spawned with the default restored.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // Held until the attach reply block has been read from dispatch(), so
+    // a slow tmux server never stalls the caller
+    m_attached = false;
+
+    // Pane output is never needed, and would dominate the traffic
+    send("refresh-client -f no-output");
+    return true;
+}
+
+void TmuxControl::disconnect() {
+    if (!connected()) {
+        return;
+    }
+
+    // After any queued writes, closing stdin lets the client finish its
+    // commands and exit. Its output is drained meanwhile, so it can't block.
+    // The launcher reaps it.
+    m_poller.remove(m_out);
+    m_executor.post([in = m_in, out = m_out] {
+        close(in);
+        fcntl(out, F_SETFL, fcntl(out, F_GETFL) & ~O_NONBLOCK);
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(out, buf, sizeof(buf))) > 0 ||
+               (n < 0 && errno == EINTR)) {
+        }
+        close(out);
+    });
+    m_pid = -1;
+    m_in = -1;
+    m_out = -1;
+
+    m_buf.clear();
+    m_block.reset();
+    m_held.clear();
+
+    std::deque<Callback> pending;
+    std::swap(pending, m_pending);
+    for (Callback &callback : pending) {
+        if (callback) {
+            callback({.ok = false, .lines = {}});
+        }
+    }
+}
+
+bool TmuxControl::fill_buffer() {
+    char buf[4096];
+    while (true) {
+        ssize_t n = read(m_out, buf, sizeof(buf));
+        if (n > 0) {
+            m_buf.append(buf, n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            return true;
+        } else {
+            // EOF or error: client has exited
+            log_msg("tmux control client exited.\n");
+            disconnect();
+            return false;
+        }
+    }
+}
+
+void TmuxControl::process_buffer() {
+    size_t pos;
+    while ((pos = m_buf.find('\n')) != std::string::npos) {
+        std::string line = m_buf.substr(0, pos);
+        m_buf.erase(0, pos + 1);
+        handle_line(line);
+    }
+}
+
+void TmuxControl::handle_line(std::string_view line) {
+    // Guard lines are "%begin|%end|%error <time> <number> <flags>"
+    constexpr std::string_view begin = "%begin ";
+    constexpr std::string_view end = "%end ";
+    constexpr std::string_view error = "%error ";
+
+    if (m_block.has_value()) {
+        bool is_end = line.starts_with(end) &&
+                      line.substr(end.size()) == m_block_tag;
+        bool is_error = line.starts_with(error) &&
+                        line.substr(error.size()) == m_block_tag;
+
+        if (!is_end && !is_error) {
+            m_block->lines.emplace_back(line);
+            return;
+        }
+
+        TmuxReply reply = std::move(m_block.value());
+        reply.ok = is_end;
+        m_block.reset();
+
+        if (!m_block_ours) {
+            attached();
+        } else if (!m_pending.empty()) {
+            Callback callback = std::move(m_pending.front());
+            m_pending.pop_front();
+            if (callback) {
+                callback(reply);
+            }
+        }
+        return;
+    }
+
+    if (line.starts_with(begin)) {
+        m_block_tag = line.substr(begin.size());
+        // Flags are 1 if the command was sent by this client
+        m_block_ours = m_block_tag.ends_with(" 1");
+        m_block = TmuxReply{.ok = true, .lines = {}};
+    } else if (line.starts_with("%")) {
+        m_notifications.emplace_back(line);
+    }
+}
+
+void TmuxControl::attached() {
+    if (m_attached) {
+        return;
+    }
+    m_attached = true;
+    std::deque<std::string> held;
+    std::swap(held, m_held);
+    for (std::string &line : held) {
+        write_line(std::move(line));
+    }
+}
+
+std::string tmux_quote(std::string_view arg) {
+    std::string ret = "'";
+    for (char c : arg) {
+        if (c == '\'') {
+            ret.append("'\\''");
+        } else if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f) {
+            // Commands are newline delimited
+            ret.push_back(' ');
+        } else {
+            ret.push_back(c);
+        }
+    }
+    ret.push_back('\'');
+    return ret;
+}
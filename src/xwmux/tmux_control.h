@@ -0,0 +1,114 @@
+/*
+ * Persistent tmux control mode client.
+ *
+ * xwmux owns a single `tmux -C` client for its whole lifetime. Commands are
+ * written to its stdin one per line (from the executor thread), and each
+ * reply is read back on the main thread from the matching %begin/%end (or
+ * %error) block on its stdout, in order.
+ * Notifications (lines starting with % outside of a block) are queued, to be
+ * handled from the main loop.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "executor.h"
+#include "poller.h"
+
+struct TmuxReply {
+    bool ok;
+    std::vector<std::string> lines;
+};
+
+class TmuxControl {
+  public:
+    using Callback = std::function<void(const TmuxReply &)>;
+
+    // Writes go through the executor, and output is waited on through the
+    // poller, both constructed first so they outlive us
+    TmuxControl(std::string session)
+        : m_executor(executor()), m_poller(poller()),
+          m_session(std::move(session)) {}
+
+    ~TmuxControl() { disconnect(); }
+
+    TmuxControl(const TmuxControl &other) = delete;
+    TmuxControl &operator=(const TmuxControl &other) = delete;
+
+    // Write a single command (no ';' separators), the callback receives the
+    // reply once it has been read.
+    // Connects lazily, returns false if tmux could not be started. Commands
+    // sent while attaching are held until then.
+    bool send(std::string_view cmd, Callback callback = {});
+
+    // Handle all output currently available without blocking.
+    void dispatch();
+
+    // Pop the oldest queued notification, if any
+    std::optional<std::string> next_notification();
+
+    bool has_notifications() const { return !m_notifications.empty(); }
+
+    // Start attaching to the session, if not yet connected. Never waits on
+    // tmux, the attach completes from dispatch().
+    bool connect();
+
+    bool connected() const { return m_pid > 0; }
+
+  private:
+    void disconnect();
+
+    // Read whatever is available into the buffer, without blocking.
+    // Returns false once the client has gone away.
+    bool fill_buffer();
+
+    // Handle all complete lines in the buffer
+    void process_buffer();
+
+    void handle_line(std::string_view line);
+
+    // Write a line to the client's stdin, from the executor
+    void write_line(std::string line);
+
+    // The attach reply block has been read, write the held commands
+    void attached();
+
+    Executor &m_executor;
+    Poller &m_poller;
+    std::string m_session;
+
+    pid_t m_pid{-1};
+    int m_in{-1};
+    int m_out{-1};
+
+    // Output not yet split into lines
+    std::string m_buf;
+
+    // Callbacks for commands written, but not yet replied to
+    std::deque<Callback> m_pending;
+
+    // Reply block currently being read, if any.
+    // Blocks not started by us (e.g. on attach) are read but discarded.
+    std::optional<TmuxReply> m_block;
+    std::string m_block_tag;
+    bool m_block_ours{};
+
+    // Reply to the initial attach has been read
+    bool m_attached{};
+
+    // Commands sent before then, in order
+    std::deque<std::string> m_held;
+
+    std::deque<std::string> m_notifications;
+};
+
+// Quote a string as a single tmux command argument
+std::string tmux_quote(std::string_view arg);
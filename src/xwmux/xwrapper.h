@@ -1,19 +1,40 @@
 #pragma once
 
 extern "C" {
+#include <X11/Xatom.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/sync.h>
+#include <xcb/xcb.h>
+#include <xcb/xproto.h>
 }
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <format>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
+#include "atoms.h"
+#include "launcher.h"
 #include "layout.h"
+#include "outputs.h"
+#include "properties.h"
+#include "timers.h"
 
 const std::string ROOT_CLASS = "xwmux_root";
 
+// Session for a root terminal to attach to (see xwmux-init-term.sh)
+const std::string SESSION_VAR = "XWMUX_SESSION";
+
 struct ModifiedKeyCode {
     ModifiedKeyCode(const KeyCode keycode, const uint modifiers)
         : keycode(keycode), modifiers(modifiers) {}
@@ -22,27 +43,294 @@ struct ModifiedKeyCode {
     uint modifiers;
 };
 
+// _NET_WM_SYNC_REQUEST state of a window. Once the client is sent a
+// configure, it is not sent another until it has redrawn (set its counter to
+// the requested value), or the request times out.
+struct SyncRequest {
+    XSyncCounter counter;
+    XSyncAlarm alarm{None};
+    uint64_t value{};
+
+    bool awaiting{};
+    std::optional<Timers::TimerID> timeout{};
+
+    // Latest position requested meanwhile
+    std::optional<WindowPosition> deferred{};
+};
+
+// Unresponsive clients are configured anyway after this long
+constexpr std::chrono::milliseconds SYNC_TIMEOUT(200);
+
+// Last state requested of a window. Only the window manager moves or maps
+// managed windows, so it stays accurate until the window is unmapped by its
+// client or destroyed.
+struct ShadowWindow {
+    std::optional<WindowPosition> position;
+    std::optional<bool> mapped;
+    bool lowered{};
+
+    // Hidden while mapped (see HideMode)
+    bool hidden{};
+
+    // If the client supports it
+    std::optional<SyncRequest> sync;
+
+    // A root terminal, stacked between shown and hidden windows
+    bool term{};
+
+    // A floating overlay, stacked above everything else
+    bool floating{};
+
+    // Covering its output. Positions requested meanwhile are kept, and
+    // applied once it leaves fullscreen.
+    bool fullscreen{};
+    std::optional<WindowPosition> restore{};
+};
+
+// How windows outside the active tmux window are hidden. Heavy clients
+// (browsers, GL) rebuild their surfaces when remapped, so may be kept mapped.
+enum class HideMode {
+    // Unmapped
+    UNMAP,
+    // Moved right of the screen, keeping their size
+    OFFSCREEN,
+    // Stacked below the root terminal
+    RESTACK,
+};
+
+const std::string HIDE_MODE_VAR = "XWMUX_HIDE_MODE";
+
+inline HideMode hide_mode_from_env() {
+    const char *value = std::getenv(HIDE_MODE_VAR.c_str());
+    std::string_view mode = value ? value : "";
+    if (mode == "offscreen") {
+        return HideMode::OFFSCREEN;
+    } else if (mode == "restack") {
+        return HideMode::RESTACK;
+    }
+    return HideMode::UNMAP;
+}
+
 struct XState {
     XState()
         : display(XOpenDisplay(nullptr)), root(XDefaultRootWindow(display)),
           screen(XDefaultScreenOfDisplay(display)), resolution(display),
-          term_layout(display, Resolution()) {}
+          outputs(display),
+          connection(display ? XGetXCBConnection(display) : nullptr),
+          properties(display, connection),
+          hide_mode(hide_mode_from_env()) {
+        int error_base, major, minor;
+        if (display && XSyncQueryExtension(display, &sync_event_base,
+                                           &error_base) &&
+            XSyncInitialize(display, &major, &minor)) {
+            has_sync = true;
+        }
+    }
+
+    void set_resolution(const Resolution res) { resolution = res; }
+
+    void set_term(const Window id) { shadow[id].term = true; }
+
+    void set_floating(const Window id) { shadow[id].floating = true; }
+
+    // Requests below are skipped when they would not change anything
+
+    void move_resize(const Window id, const WindowPosition &pos) {
+        ShadowWindow &window = shadow[id];
+        if (window.fullscreen) {
+            window.restore = pos;
+            return;
+        }
+        configure(id, pos);
+    }
 
-    void set_resolution(const Resolution res) {
-        resolution = res;
-        term_layout.set_screen_resolution(resolution);
-        if (term.has_value()) {
-            res.fullscreen().resize_to(display, term.value());
-            set_term(term.value());
+    // Cover an area (its output) and stack above the terminal, until
+    // unset_fullscreen()
+    void set_fullscreen(const Window id, const WindowPosition &area) {
+        ShadowWindow &window = shadow[id];
+        if (!window.fullscreen) {
+            window.fullscreen = true;
+            window.restore =
+                window.sync.has_value() && window.sync->deferred.has_value()
+                    ? window.sync->deferred
+                    : window.position;
+            update_net_wm_state(id);
         }
+        configure(id, area);
+        raise(id);
     }
 
-    void set_term(const Window term) { this->term = term; }
+    // Back to the last position requested
+    void unset_fullscreen(const Window id) {
+        ShadowWindow &window = shadow[id];
+        if (!window.fullscreen) {
+            return;
+        }
+        window.fullscreen = false;
+        update_net_wm_state(id);
+        if (window.restore.has_value()) {
+            WindowPosition pos = window.restore.value();
+            window.restore.reset();
+            configure(id, pos);
+        }
+    }
+
+    bool is_fullscreen(const Window id) const {
+        auto it = shadow.find(id);
+        return it != shadow.end() && it->second.fullscreen;
+    }
+
+    // True if the request was sent
+    bool map(const Window id) {
+        std::optional<bool> &mapped = shadow[id].mapped;
+        if (mapped == true) {
+            return false;
+        }
+        XMapWindow(display, id);
+        mapped = true;
+        return true;
+    }
+
+    // True if the request was sent (and an UnmapNotify will follow)
+    bool unmap(const Window id) {
+        std::optional<bool> &mapped = shadow[id].mapped;
+        if (mapped == false) {
+            return false;
+        }
+        XUnmapWindow(display, id);
+        mapped = false;
+        return true;
+    }
+
+    void lower(const Window id) {
+        bool &lowered = shadow[id].lowered;
+        if (!lowered) {
+            XLowerWindow(display, id);
+            lowered = true;
+        }
+    }
+
+    // Other clients may have been stacked above it since
+    void raise(const Window id) {
+        shadow[id].lowered = false;
+        XRaiseWindow(display, id);
+    }
+
+    // Hide a window according to the hide mode, true if it was unmapped
+    bool hide(const Window id) {
+        if (hide_mode == HideMode::UNMAP) {
+            set_hidden(id, true);
+            return unmap(id);
+        }
+
+        ShadowWindow &window = shadow[id];
+        if (window.hidden) {
+            return false;
+        }
+        set_hidden(id, true);
+        if (hide_mode == HideMode::OFFSCREEN && window.position.has_value()) {
+            screen_position(window).resize_to(display, id);
+        }
+        return false;
+    }
+
+    void show(const Window id) {
+        ShadowWindow &window = shadow[id];
+        if (window.hidden) {
+            set_hidden(id, false);
+            if (hide_mode == HideMode::OFFSCREEN &&
+                window.position.has_value()) {
+                window.position->resize_to(display, id);
+            }
+        }
+        map(id);
+    }
+
+    // Apply hiding by stacking, in a single request, once a tmux window has
+    // been shown
+    void restack() {
+        if (hide_mode != HideMode::RESTACK || !restack_pending) {
+            return;
+        }
+        restack_pending = false;
+
+        // Top to bottom: shown overlays, shown fullscreen windows (which
+        // cover their output), shown windows, the terminals, then hidden
+        // windows
+        std::vector<Window> floating, fullscreen, shown, terms, hidden;
+        for (auto &[id, window] : shadow) {
+            if (window.mapped != true) {
+                continue;
+            }
+            if (window.term) {
+                terms.push_back(id);
+                window.lowered = false;
+            } else if (window.floating && !window.hidden) {
+                floating.push_back(id);
+            } else if (window.fullscreen && !window.hidden) {
+                fullscreen.push_back(id);
+            } else {
+                (window.hidden ? hidden : shown).push_back(id);
+            }
+        }
+        std::vector<Window> order = std::move(floating);
+        order.insert(order.end(), fullscreen.begin(), fullscreen.end());
+        order.insert(order.end(), shown.begin(), shown.end());
+        order.insert(order.end(), terms.begin(), terms.end());
+        order.insert(order.end(), hidden.begin(), hidden.end());
+
+        // The first window keeps its place, so must already be on top
+        if (!order.empty()) {
+            XRaiseWindow(display, order.front());
+            XRestackWindows(display, order.data(), order.size());
+        }
+    }
+
+    // The window has changed outside of our requests, or is gone
+    void forget(const Window id) {
+        auto it = shadow.find(id);
+        if (it == shadow.end()) {
+            return;
+        }
+        if (it->second.sync.has_value()) {
+            if (it->second.sync->alarm != None) {
+                XSyncDestroyAlarm(display, it->second.sync->alarm);
+            }
+            if (it->second.sync->timeout.has_value()) {
+                timers().cancel(it->second.sync->timeout.value());
+            }
+        }
+        shadow.erase(it);
+    }
+
+    // Where a window is placed in a pane, given its size hints
+    WindowPosition fit(const WindowLayouts &layout, const Window id,
+                       const WindowPosition &pane) {
+        return layout.fit(pane, properties.get(id).size_hints);
+    }
+
+    // Synchronise configures of a window with its redraws
+    void set_sync_counter(const Window id, const XSyncCounter counter) {
+        if (has_sync) {
+            shadow[id].sync = SyncRequest{.counter = counter};
+        }
+    }
+
+    // Handle an XSyncAlarmNotify: the client has redrawn
+    void sync_done(const XSyncAlarm alarm) {
+        for (auto &[id, window] : shadow) {
+            if (window.sync.has_value() && window.sync->alarm == alarm) {
+                finish_sync(id, window.sync.value());
+                return;
+            }
+        }
+    }
 
     void sync() { XSync(display, 0); }
 
-    void focus_term() const {
-        XSetInputFocus(display, term.value_or(root), 0, 0);
+    // Focus a window, or the root window
+    void focus(const std::optional<Window> id) const {
+        XSetInputFocus(display, id.value_or(root), 0, 0);
     }
 
     void set_prefix(const ModifiedKeyCode new_prefix) {
@@ -71,61 +359,156 @@ struct XState {
         grabbed = false;
     }
 
-    constexpr bool is_root_term(Window id) {
-        XClassHint *hint = XAllocClassHint();
-        bool ret = XGetClassHint(display, id, hint)
-                       ? std::strcmp(hint->res_class, ROOT_CLASS.c_str()) == 0
-                       : false;
-        XFree(hint);
-        return ret;
-    }
-
-    int open_term() { return std::system("xwmux-launch-term.sh"); }
-
-    void close_term() {
-        // Close current window
-        if (term.has_value()) {
-            XKillClient(display, term.value());
-        }
-    }
-
-    constexpr std::optional<int> init_state(Window id) {
-        WrappedHints whints(display, id);
-        if (whints.get() && whints.get()->flags & StateHint)
-            return whints.get()->initial_state;
-        return std::nullopt;
+    // Returns immediately, the script starts the terminal in the background.
+    // The callback receives the script's exit status.
+    bool open_term(const std::string &session,
+                   Launcher::ExitCallback on_exit = {}) {
+        return launcher().spawn(
+                   {"xwmux-launch-term.sh"}, std::move(on_exit),
+                   {.set_env = {std::format("{}={}", SESSION_VAR, session)}}) >
+               0;
     }
 
-    constexpr bool override_redirect(Window id) {
-        XWindowAttributes attr;
-        XGetWindowAttributes(display, id, &attr);
-        return attr.override_redirect;
-    }
+    void close_term(const Window id) { XKillClient(display, id); }
 
     Display *display;
     Window root;
     Screen *screen;
+    // Of the whole screen, spanning every output
     Resolution resolution;
-    WindowLayouts term_layout;
+    Outputs outputs;
+
+    // Xlib's own connection, for requests which are pipelined
+    xcb_connection_t *connection;
+
+    PropertyCache properties;
+
+    std::unordered_map<Window, ShadowWindow> shadow;
+
+    const HideMode hide_mode;
+    bool restack_pending{};
 
-    std::optional<Window> term;
+    // XSync extension, for _NET_WM_SYNC_REQUEST
+    bool has_sync{};
+    int sync_event_base{-1};
 
     std::optional<ModifiedKeyCode> prefix;
     bool grabbed{};
 
   private:
-    struct WrappedHints {
-      public:
-        WrappedHints(Display *display, Window id)
-            : hints(XGetWMHints(display, id)) {}
-        ~WrappedHints() {
-            XFree(hints);
-        }
-        WrappedHints(const WrappedHints &other) = delete;
-        WrappedHints &operator=(const WrappedHints &other) = delete;
-        const XWMHints *get() const { return hints; };
-
-      private:
-        XWMHints *const hints;
-    };
+    // Ask the client to set its counter once it has redrawn after the
+    // configure which follows
+    void request_sync(const Window id, SyncRequest &sync) {
+        sync.value++;
+        XSyncValue value;
+        XSyncIntsToValue(&value, sync.value & 0xFFFFFFFF, sync.value >> 32);
+
+        XSyncAlarmAttributes attr{};
+        attr.trigger.counter = sync.counter;
+        attr.trigger.value_type = XSyncAbsolute;
+        attr.trigger.wait_value = value;
+        attr.trigger.test_type = XSyncPositiveComparison;
+        attr.events = True;
+        const unsigned long mask = XSyncCACounter | XSyncCAValueType |
+                                   XSyncCAValue | XSyncCATestType |
+                                   XSyncCAEvents;
+        if (sync.alarm == None) {
+            sync.alarm = XSyncCreateAlarm(display, mask, &attr);
+        } else {
+            XSyncChangeAlarm(display, sync.alarm, mask, &attr);
+        }
+
+        XEvent ev{};
+        ev.xclient.type = ClientMessage;
+        ev.xclient.window = id;
+        ev.xclient.message_type = atoms(display)[AtomID::WM_PROTOCOLS];
+        ev.xclient.format = 32;
+        ev.xclient.data.l[0] = atoms(display)[AtomID::NET_WM_SYNC_REQUEST];
+        ev.xclient.data.l[1] = CurrentTime;
+        ev.xclient.data.l[2] = XSyncValueLow32(value);
+        ev.xclient.data.l[3] = XSyncValueHigh32(value);
+        XSendEvent(display, id, False, NoEventMask, &ev);
+
+        sync.awaiting = true;
+
+        // Stop waiting on clients which do not answer in time
+        sync.timeout =
+            timers().add(Timers::Clock::now() + SYNC_TIMEOUT, [this, id] {
+                ShadowWindow &window = shadow[id];
+                window.sync->timeout.reset();
+                finish_sync(id, window.sync.value());
+            });
+    }
+
+    // Send the latest position requested while waiting, if any
+    void finish_sync(const Window id, SyncRequest &sync) {
+        sync.awaiting = false;
+        if (sync.timeout.has_value()) {
+            timers().cancel(sync.timeout.value());
+            sync.timeout.reset();
+        }
+        if (sync.deferred.has_value()) {
+            WindowPosition pos = sync.deferred.value();
+            sync.deferred.reset();
+            configure(id, pos);
+        }
+    }
+
+    void configure(const Window id, const WindowPosition &pos) {
+        ShadowWindow &window = shadow[id];
+        if (window.sync.has_value() && window.sync->awaiting) {
+            window.sync->deferred = pos;
+            return;
+        }
+        if (window.position != pos) {
+            window.position = pos;
+            if (window.sync.has_value()) {
+                request_sync(id, window.sync.value());
+            }
+            screen_position(window).resize_to(display, id);
+        }
+    }
+
+    // Where a window is actually placed, given its (logical) position
+    WindowPosition screen_position(const ShadowWindow &window) const {
+        WindowPosition ret = window.position.value();
+        if (window.hidden && hide_mode == HideMode::OFFSCREEN) {
+            ret.start.x += resolution.x;
+            ret.end.x += resolution.x;
+        }
+        return ret;
+    }
+
+    // Clients may throttle rendering while hidden
+    void set_hidden(const Window id, const bool hidden) {
+        ShadowWindow &window = shadow[id];
+        if (window.hidden == hidden) {
+            return;
+        }
+        window.hidden = hidden;
+        restack_pending = true;
+        update_net_wm_state(id);
+    }
+
+    // Tell the client which of the states xwmux manages it has
+    void update_net_wm_state(const Window id) {
+        const ShadowWindow &window = shadow[id];
+        std::vector<Atom> state;
+        if (window.hidden) {
+            state.push_back(atoms(display)[AtomID::NET_WM_STATE_HIDDEN]);
+        }
+        if (window.fullscreen) {
+            state.push_back(atoms(display)[AtomID::NET_WM_STATE_FULLSCREEN]);
+        }
+
+        const Atom net_wm_state = atoms(display)[AtomID::NET_WM_STATE];
+        if (state.empty()) {
+            XDeleteProperty(display, id, net_wm_state);
+        } else {
+            XChangeProperty(display, id, net_wm_state, XA_ATOM, 32,
+                            PropModeReplace,
+                            reinterpret_cast<unsigned char *>(state.data()),
+                            state.size());
+        }
+    }
 };